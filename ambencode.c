@@ -23,12 +23,35 @@ THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 
  * -------------------------------------------------------------------- */
 
+/* A mapped bobject pool is grown with mremap() which moves pages rather
+ * than copying them, this is only available on Linux. Elsewhere
+ * ambencode_alloc_mapped() allocates an ordinary managed pool.
+ */
+#if defined(__linux__) && !defined(USEMALLOCPOOL)
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#define AM_MREMAP
+#endif
+
 #include <stdlib.h>
 #include <errno.h>
 #include <string.h>
+#include <stddef.h>
+
+#ifdef AM_MREMAP
+#include <sys/mman.h>
+#endif
 
 #include "ambencode.h"
 
+/* The parallel arrays of a structure of arrays pool are grown with
+ * realloc(), such pools are never mapped.
+ */
+#if defined(AM_MREMAP) && defined(AMBENCODE_SOA)
+#undef AM_MREMAP
+#endif
+
 /* -------------------------------------------------------------------- */
 
 #ifdef USEBRANCHHINTS
@@ -39,476 +62,2777 @@ THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 #define AM_UNLIKELY(x)     (x)
 #endif
 
+/* Digit runs are scanned 16 or 8 bytes at a time depending on the
+ * instructions available, SWAR (SIMD within a register) requires a 
+ * little endian target. Valid digit runs are at most 20 bytes, wider
+ * AVX2 loads were measured to be slower.
+ */
+#if !defined(USESCALARDIGITS) && defined(__GNUC__) && \
+  defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+#define AM_SWAR
+#if defined(__SSE4_1__)
+#define AM_SSE4
+#endif
+#endif
+
+#ifdef AM_SSE4
+#include <immintrin.h>
+#endif
+
+/* Scanning strings and numbers is shared by every decoder, the helpers
+ * are forced inline as calls on this path were measured to be slower.
+ */
+#ifdef __GNUC__
+#define AM_INLINE          __inline__ __attribute__((always_inline))
+#else
+#define AM_INLINE
+#endif
+
+
+/* Return codes used internally by the decoder, previously these were
+ * the values passed to longjmp()
+ */
+#define DECODE_OK     0
+#define DECODE_ENOMEM 1
+#define DECODE_EINVAL 2
+
+/* Pool sizing learnt by ambencode_reset() handles, density is held as
+ * bobjects per DENSITY_BYTES of BENCODE data and the pool is checked for
+ * being much larger than recently required every SHRINK_RESETS resets.
+ */
+#define DENSITY_BYTES     1024
+#define SHRINK_RESETS     256
+
+/* Slots first allocated for interned keys, the slots are doubled once
+ * half are used
+ */
+#define SYMBOL_SLOTS      64
+
+/* Where ambencode_feed() resumes parsing when it is next called, zero
+ * is the initial state set by ambencode_alloc()
+ */
+#define FEED_VALUE        0       /* Start of a value or 'e' */
+#define FEED_LENGTH       1       /* Within a string length prefix */
+#define FEED_STRING       2       /* Within string data */
+#define FEED_NUMBER       3       /* Within a number */
+#define FEED_FAIL         4       /* A previous call failed */
+
+/* Byte classes, every byte of BENCODE data the decoder inspects outside
+ * of string data is mapped to one of these classes which is then used
+ * to dispatch to the code handling it, either by a switch or when
+ * USECOMPUTEDGOTO is defined through a table of label addresses. The
+ * sign, leading zero and terminator of length prefixes and integers are
+ * also checked by class, runs of digits are found by ambencode_digits().
+ */
+#define BCLASS_INVALID    0
+#define BCLASS_ZERO       1       /* '0' */
+#define BCLASS_DIGIT      2       /* '1'...'9' */
+#define BCLASS_COLON      3       /* ':' */
+#define BCLASS_MINUS      4       /* '-' */
+#define BCLASS_INTEGER    5       /* 'i' */
+#define BCLASS_DICTIONARY 6       /* 'd' */
+#define BCLASS_LIST       7       /* 'l' */
+#define BCLASS_END        8       /* 'e' */
+#define BCLASS_COUNT      9
+
+static const unsigned char bclass[256] = {
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, /* 0x00 */
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, /* 0x10 */
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 4, 0, 0, /* 0x20 */
+  1, 2, 2, 2, 2, 2, 2, 2, 2, 2, 3, 0, 0, 0, 0, 0, /* 0x30 */
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, /* 0x40 */
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, /* 0x50 */
+  0, 0, 0, 0, 6, 8, 0, 0, 0, 5, 0, 0, 7, 0, 0, 0, /* 0x60 */
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, /* 0x70 */
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, /* 0x80 */
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, /* 0x90 */
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, /* 0xa0 */
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, /* 0xb0 */
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, /* 0xc0 */
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, /* 0xd0 */
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, /* 0xe0 */
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0  /* 0xf0 */
+};
+
+#define BCLASS(c)         (bclass[(unsigned char)(c)])
+
+/* The grammar shared by every decoder given the whole of it's input,
+ * each of ambencode_walk(), ambencode_document(), ambencode_tape() and
+ * ambencode_select() expands BGRAMMAR(mode, base) in it's body having
+ * defined these hooks for what it does with the values found:
+ *
+ *   mode_FAIL(code)      the input is invalid, code is an AMBENCODE_E*
+ *   mode_DOCUMENT        a value at depth base starts at ptr
+ *   mode_KEY             a key starts at ptr, move ptr past it
+ *   mode_STRING          a string starts at ptr, move ptr past it
+ *   mode_NUMBER          an integer starts at ptr, move ptr past it
+ *   mode_OPEN            a container starts at ptr
+ *   mode_SAVE(frame)     the innermost container is saved to frame
+ *   mode_RESET           a container has been opened, it is innermost
+ *   mode_RESTORE(frame)  the innermost container is restored from frame
+ *   mode_COMPLETE        a value has been completed
+ *   mode_TOP             a value at depth base has been completed
+ *   mode_CHILD           a value of the innermost container completed
+ *   mode_MEMBER          a list continues at ptr with a value or 'e'
+ *   mode_CLOSE           a container has been closed, ptr is past it
+ *   mode_SETTLED         a value at depth base was completed or skipped
+ *
+ * A hook may jump to complete, next or settled, the function itself
+ * provides the label done which is reached once the input has been 
+ * consumed. The innermost container is held in the locals count and
+ * type, those it is within are saved on the container stack above base.
+ * ambencode_feed() which resumes across buffers is the only other copy.
+ */
+#ifdef USECOMPUTEDGOTO
+#define BGRAMMAR_TABLES                                                       \
+  static const void * const value_start[BCLASS_COUNT] = {                     \
+    &&unexpected, &&string, &&string, &&unexpected, &&unexpected,             \
+    &&number, &&dictionary, &&list, &&unexpected                              \
+  };                                                                          \
+  static const void * const list_next[BCLASS_COUNT] = {                       \
+    &&unexpected, &&string, &&string, &&unexpected, &&unexpected,             \
+    &&number, &&dictionary, &&list, &&end                                     \
+  };                                                                          \
+  static const void * const dictionary_next[BCLASS_COUNT] = {                 \
+    &&badkey, &&key, &&key, &&badkey, &&badkey,                               \
+    &&badkey, &&badkey, &&badkey, &&end                                       \
+  };
+
+#define BGRAMMAR_VALUE      goto *value_start[BCLASS(*ptr)]
+#define BGRAMMAR_LIST       goto *list_next[BCLASS(*ptr)]
+#define BGRAMMAR_DICTIONARY goto *dictionary_next[BCLASS(*ptr)]
+#else
+#define BGRAMMAR_TABLES
+#define BGRAMMAR_VALUE                                                        \
+  switch (BCLASS(*ptr)) {                                                     \
+  case BCLASS_ZERO:                                                           \
+  case BCLASS_DIGIT:      goto string;                                        \
+  case BCLASS_INTEGER:    goto number;                                        \
+  case BCLASS_DICTIONARY: goto dictionary;                                    \
+  case BCLASS_LIST:       goto list;                                          \
+  default:                goto unexpected;                                    \
+  }
+#define BGRAMMAR_LIST                                                         \
+  switch (BCLASS(*ptr)) {                                                     \
+  case BCLASS_ZERO:                                                           \
+  case BCLASS_DIGIT:      goto string;                                        \
+  case BCLASS_INTEGER:    goto number;                                        \
+  case BCLASS_DICTIONARY: goto dictionary;                                    \
+  case BCLASS_LIST:       goto list;                                          \
+  case BCLASS_END:        goto end;                                           \
+  default:                goto unexpected;                                    \
+  }
+#define BGRAMMAR_DICTIONARY                                                   \
+  switch (BCLASS(*ptr)) {                                                     \
+  case BCLASS_ZERO:                                                           \
+  case BCLASS_DIGIT:      goto key;                                           \
+  case BCLASS_END:        goto end;                                           \
+  default:                goto badkey;                                        \
+  }
+#endif
+
+#define BGRAMMAR(mode, base)                                                  \
+{                                                                             \
+  BGRAMMAR_TABLES                                                             \
+                                                                              \
+  if (AM_UNLIKELY(eptr == ptr)) mode##_FAIL(AMBENCODE_ETRUNCATED);            \
+                                                                              \
+ document:                                                                    \
+  mode##_DOCUMENT                                                             \
+                                                                              \
+ value:                                                                       \
+  BGRAMMAR_VALUE;                                                             \
+                                                                              \
+ key:                                                                         \
+  mode##_KEY                                                                  \
+  goto complete;                                                              \
+                                                                              \
+ string:                                                                      \
+  mode##_STRING                                                               \
+  goto complete;                                                              \
+                                                                              \
+ number:                                                                      \
+  mode##_NUMBER                                                               \
+  goto complete;                                                              \
+                                                                              \
+ dictionary:                                                                  \
+ list:                                                                        \
+  mode##_OPEN                                                                 \
+  if (AM_UNLIKELY(depth + 1 >= max_depth)) mode##_FAIL(AMBENCODE_EDEPTH);     \
+                                                                              \
+  if (depth > (base)) {                                                       \
+    struct bframe *frame = &stack[depth];                                     \
+                                                                              \
+    frame->count = count;                                                     \
+    frame->type  = type;                                                      \
+    mode##_SAVE(frame)                                                        \
+  }                                                                           \
+  depth++;                                                                    \
+                                                                              \
+  type  = (*ptr == 'd')?AMBENCODE_DICTIONARY:AMBENCODE_LIST;                  \
+  count = 0;                                                                  \
+  mode##_RESET                                                                \
+                                                                              \
+  ptr++;                                                                      \
+  goto next;                                                                  \
+                                                                              \
+ complete:                                                                    \
+  mode##_COMPLETE                                                             \
+  if (AM_UNLIKELY(depth == (base))) {                                         \
+    mode##_TOP                                                                \
+    goto settled;                                                             \
+  }                                                                           \
+                                                                              \
+  if (AM_UNLIKELY(count == AMBENCODE_LENMASK)) mode##_FAIL(AMBENCODE_ECOUNT); \
+  mode##_CHILD                                                                \
+  count++;                                                                    \
+                                                                              \
+ next:                                                                        \
+  if (AM_UNLIKELY(eptr == ptr)) mode##_FAIL(AMBENCODE_ETRUNCATED);            \
+  if (type == AMBENCODE_DICTIONARY) {                                         \
+    if (count & 1) goto value;                                                \
+    BGRAMMAR_DICTIONARY;                                                      \
+  }                                                                           \
+  mode##_MEMBER                                                               \
+  BGRAMMAR_LIST;                                                              \
+                                                                              \
+ end:                                                                         \
+  ptr++;                                                                      \
+  mode##_CLOSE                                                                \
+                                                                              \
+  if (--depth > (base)) {                                                     \
+    struct bframe *frame = &stack[depth];                                     \
+                                                                              \
+    count = frame->count;                                                     \
+    type  = frame->type;                                                      \
+    mode##_RESTORE(frame)                                                     \
+  }                                                                           \
+  goto complete;                                                              \
+                                                                              \
+ settled:                                                                     \
+  mode##_SETTLED                                                              \
+  if (eptr == ptr) goto done;                                                 \
+  goto document;                                                              \
+                                                                              \
+ badkey:                                                                      \
+  mode##_FAIL(AMBENCODE_EKEY);                                                \
+                                                                              \
+ unexpected:                                                                  \
+  mode##_FAIL(AMBENCODE_EUNEXPECTED);                                         \
+}
+
 /* -------------------------------------------------------------------- */
 /* -------------------------------------------------------------------- */
 
-static void ambencode_document(struct bhandle * const bhandle, char **optr);
-static void ambencode_dictionary(struct bhandle * const bhandle, char **optr);
-static void ambencode_list(struct bhandle * const bhandle, char **optr);
-static void ambencode_value(struct bhandle * const bhandle, char **optr);
-static void ambencode_string(struct bhandle * const bhandle, char **optr);
-static void ambencode_number(struct bhandle * const bhandle, char **optr);
+struct bobject *bobject_allocate(struct bhandle * const bhandle, poff_t count);
+static void *bobject_resize(struct bhandle * const bhandle, poff_t ncount);
+static int bobject_tables(struct bhandle * const bhandle, poff_t ncount);
+static int bobject_intern(struct bhandle * const bhandle, poff_t key, 
+			  bsize_t count);
+static void bobject_span(struct bhandle * const bhandle, 
+			 struct bobject * const bobject, const char * const end);
+static void bobject_parent(struct bhandle * const bhandle, 
+			   struct bobject * const bobject);
+static void bobject_document(struct bhandle * const bhandle, poff_t value);
+static int bsymbol_grow(struct bhandle * const bhandle);
+int bsymbol_release(struct bhandle * const bhandle, poff_t key);
+static size_t bsymbol_hash(const char *ptr, bsize_t len);
+#ifdef AMBENCODE_SOA
+static int bobject_arrays(struct bhandle * const bhandle, poff_t ncount);
+#endif
+static int bobject_reserve(struct bhandle * const bhandle, size_t count);
+void bfind_free(struct bhandle * const bhandle);
+static void bobject_expect(struct bhandle * const bhandle, xbsize_t len);
+static void bobject_learn(struct bhandle * const bhandle, xbsize_t len);
+static int bobject_data(struct bhandle * const bhandle, size_t len,
+			poff_t * const offset);
+static int ambencode_walk(struct bframe * const stack, const int max_depth,
+			  const int base, char *buf, xbsize_t len, 
+			  char ** const optr, const struct bevents * const events,
+			  void *ctx, struct berror * const error,
+			  uint64_t * const values);
+static int ambencode_string_error(char **optr, char * const eptr);
+static int ambencode_number_error(char **optr, char * const eptr);
+static int ambencode_document(struct bhandle * const bhandle, char **optr);
+static int ambencode_tape(struct bhandle * const bhandle, char **optr);
+static int ambencode_select(struct bhandle * const bhandle, char **optr,
+			    const struct bselect * const select, void *ctx);
+static int ambencode_placeholder(struct bhandle * const bhandle, char *ptr);
+static char *ambencode_pass(char *ptr);
+static int ambencode_table(struct bhandle * const bhandle, poff_t list);
+static int ambencode_string(struct bhandle * const bhandle, char **optr);
+static int ambencode_number(struct bhandle * const bhandle, char **optr);
+static AM_INLINE char *ambencode_scan_string(char *ptr, char * const eptr,
+					     size_t * const olen);
+static AM_INLINE char *ambencode_scan_number(char *ptr, char * const eptr,
+					     size_t * const olen);
+static size_t ambencode_digits(const char *ptr, const char * const eptr);
+static AM_INLINE uint64_t ambencode_atou(const char *ptr, size_t len,
+					 const char * const eptr);
+static AM_INLINE int64_t ambencode_i64(const char *ptr, size_t len,
+				       const char * const eptr);
 
 /* -------------------------------------------------------------------- */
 /* -------------------------------------------------------------------- */
 int ambencode_alloc(struct bhandle * const bhandle, struct bobject *ptr,
 		 poff_t count) {
 
-  memset(bhandle, 0, sizeof(struct bhandle));
+  /* The container stack held within the bhandle needs no initialisation
+   */
+  memset(bhandle, 0, offsetof(struct bhandle, frames));
   
-  bhandle->count = count;
-  bhandle->root  = AMBENCODE_INVALID;
+  bhandle->count     = count;
+  bhandle->root      = AMBENCODE_INVALID;
+  bhandle->max_depth = AMBENCODE_MAXDEPTH;
 
   if (ptr) {
     bhandle->userbuffer = (unsigned int)1;
     bhandle->bobject    = ptr;
+#ifdef AMBENCODE_SOA
+    if (count == 0) goto error;
+    goto arrays;
+#else
     return 0;
+#endif
   }
 
   if (count == 0) goto error;
 
   if ((bhandle->bobject = (struct bobject *)malloc((size_t)bhandle->count *
 						   sizeof(struct bobject)))) {
+#ifdef AMBENCODE_SOA
+    goto arrays;
+#else
     return 0;
+#endif
   }
 
  error:
   errno = EINVAL;
   return -1;
+
+#ifdef AMBENCODE_SOA
+ arrays:
+
+  /* The data and link arrays are always managed, even for a user 
+   * supplied pool
+   */
+  if (bobject_arrays(bhandle, count) == 0) return 0;
+
+  if (!bhandle->userbuffer) free(bhandle->bobject);
+  free(bhandle->data);
+  free(bhandle->link);
+
+  errno = ENOMEM;
+  return -1;
+#endif
 }
 
 /* -------------------------------------------------------------------- */
 /* -------------------------------------------------------------------- */
-void ambencode_free(struct bhandle *bhandle) {
+int ambencode_alloc_mapped(struct bhandle * const bhandle, poff_t count,
+			   int flags) {
 
-  if (!bhandle->userbuffer) {
-    free(bhandle->bobject);
+#ifdef AM_MREMAP
+  void *ptr;
+  size_t size = (size_t)count * sizeof(struct bobject);
+
+  if (count == 0) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  ptr = mmap((void *)0, size, PROT_READ|PROT_WRITE, 
+	     MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+  if (ptr == MAP_FAILED) return -1;
+
+  /* Initialise as a user supplied pool then take ownership of it
+   */
+  ambencode_alloc(bhandle, (struct bobject *)ptr, count);
+
+  bhandle->userbuffer = (unsigned int)0;
+  bhandle->mapped     = (unsigned int)1;
+
+#ifdef MADV_HUGEPAGE
+  if (flags & AMBENCODE_HUGEPAGES) {
+    bhandle->hugepages = (unsigned int)1;
+    madvise(ptr, size, MADV_HUGEPAGE);
   }
+#endif
+
+  return 0;
+#else
+  (void)flags;
+  return ambencode_alloc(bhandle, (struct bobject *)0, count);
+#endif
 }
 
 /* -------------------------------------------------------------------- */
 /* -------------------------------------------------------------------- */
-int ambencode_decode(struct bhandle * const bhandle, char *buf, bsize_t len) {
+int ambencode_maxdepth(struct bhandle * const bhandle, int depth) {
 
-  struct bobject *object;
-  char *ptr = buf;
+  struct bframe *stack;
 
-  bhandle->buf       = buf;
-  bhandle->len       = len;
-  bhandle->eptr      = &buf[len];
-  bhandle->max_depth = AMBENCODE_MAXDEPTH;
-  bhandle->depth     = 0;
-  bhandle->useljmp   = 1;
+  if (depth < 1) {
+    errno = EINVAL;
+    return -1;
+  }
 
-  switch (setjmp(bhandle->setjmp_ctx)) {
+  if (depth <= AMBENCODE_MAXDEPTH) {
 
-  case 1:
-    /* We returned from calling ambencode_document() with an 
-     * allocation failure.
+    /* The container stack held within the bhandle is large enough
      */
-    errno = ENOMEM;
-    return -1;
+    free(bhandle->stack);
+    bhandle->stack = (struct bframe *)0;
 
-  case 2:
+  } else {
 
-    /* We returned from calling ambencode_document() with an 
-     * parser failure.
-     */
-    errno = EINVAL;
-    return -1;
+    stack = (struct bframe *)realloc(bhandle->stack,
+				     (size_t)depth * sizeof(struct bframe));
+    if (!stack) {
+      errno = ENOMEM;
+      return -1;
+    }
+
+    bhandle->stack = stack;
   }
-  
-  ambencode_document(bhandle, &ptr);
 
-  /* Our root object can be almost anything.
-   */
-  object = BOBJECT_LAST(bhandle);
-  bhandle->root = BOBJECT_OFFSET(bhandle, object);
-  
+  bhandle->max_depth = depth;
   return 0;
 }
 
 /* -------------------------------------------------------------------- */
 /* -------------------------------------------------------------------- */
-struct bobject *bobject_allocate(struct bhandle * const bhandle, poff_t count) {
+int ambencode_integers(struct bhandle * const bhandle, int enable) {
 
-  poff_t used = bhandle->used + count;
+  if (bhandle->used) {
+    errno = EINVAL;
+    return -1;
+  }
 
-  if (AM_UNLIKELY(used <= bhandle->used)) goto error; /* overflow */  
-  if (AM_LIKELY(used < bhandle->count)) {
+  if (!enable) {
+    free(bhandle->integer);
+    bhandle->integer = (int64_t *)0;
+    return 0;
+  }
 
-    struct bobject *bobject = &bhandle->bobject[bhandle->used];
-    bhandle->used = used;
-    
-    return bobject;
+  if ((!bhandle->integer) &&
+      (!(bhandle->integer = (int64_t *)malloc((size_t)bhandle->count * 
+					       sizeof(int64_t))))) {
+    errno = ENOMEM;
+    return -1;
   }
 
-  if (!bhandle->userbuffer) {
-    
-    void *ptr;
-    poff_t ncount = (bhandle->count * 2) + count;
-    
-    if (AM_UNLIKELY(ncount <= bhandle->count)) goto error; /* overflow */
-        
-    ptr = realloc(bhandle->bobject, (ncount * sizeof(struct bobject)));	  
-    if (ptr) {
-      bhandle->count   = ncount;
-      bhandle->bobject = (struct bobject *)ptr;
-      return bobject_allocate(bhandle, count);
-    }
+  return 0;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+int ambencode_get_i64(struct bhandle *bhandle, struct bobject *bobject,
+		      int64_t *value) {
+
+  int64_t result;
+
+  if (BOBJECT_TYPE(bobject) != AMBENCODE_NUMBER) {
+    errno = EINVAL;
+    return -1;
   }
 
- error:
+  if (bhandle->integer) {
+    result = BOBJECT_INT64(bhandle, bobject);
+  } else {
+
+    /* Only the digits are known to be readable, they may end the 
+     * buffer or have been copied into the pool
+     */
+    const char *ptr = BOBJECT_STRING_PTR(bhandle, bobject);
+    const size_t len = BOBJECT_STRING_LEN(bobject);
 
-  if (bhandle->useljmp) {
-    /* Jump right back to ambencode_decode() 
-     */   
-    longjmp(bhandle->setjmp_ctx, 1);  
+    result = ambencode_i64(ptr, len, ptr + len);
   }
-    
-  return (struct bobject *)0;
+
+  if (result == AMBENCODE_BIGINTEGER) {
+    errno = ERANGE;
+    return -1;
+  }
+
+  *value = result;
+  return 0;
 }
 
 /* -------------------------------------------------------------------- */
 /* -------------------------------------------------------------------- */
-static void ambencode_document(struct bhandle * const bhandle, char **optr) {
+int ambencode_intern(struct bhandle * const bhandle, int enable) {
 
-  char *ptr = *optr;
-  char * const eptr = bhandle->eptr;
+  if (bhandle->used) {
+    errno = EINVAL;
+    return -1;
+  }
 
-  if (eptr == ptr) goto fail;
+  if (!enable) {
+    free(bhandle->symbol);
+    free(bhandle->symbols);
 
-  do {
+    bhandle->symbol      = (bsize_t *)0;
+    bhandle->symbols     = (struct bsymbol *)0;
+    bhandle->symbolmask  = 0;
+    bhandle->symbolcount = 0;
+    return 0;
+  }
 
-    ambencode_value(bhandle, &ptr);
+  if (bhandle->symbol) return 0;
 
-  } while (eptr != ptr);
+  bhandle->symbol  = (bsize_t *)malloc((size_t)bhandle->count * sizeof(bsize_t));
+  bhandle->symbols = (struct bsymbol *)calloc(SYMBOL_SLOTS, sizeof(struct bsymbol));
 
-  if (eptr == ptr) {
-    *optr = ptr;
-    return;
+  if ((!bhandle->symbol) || (!bhandle->symbols)) {
+    ambencode_intern(bhandle, 0);
+    errno = ENOMEM;
+    return -1;
   }
-  
- fail:
-  longjmp(bhandle->setjmp_ctx, 2); /* jump back to ambencode_decode() with EINVAL */
+
+  bhandle->symbolmask = SYMBOL_SLOTS - 1;
+  return 0;
 }
 
 /* -------------------------------------------------------------------- */
 /* -------------------------------------------------------------------- */
-static void ambencode_dictionary(struct bhandle * const bhandle, char **optr) {
-
-  char *ptr = *optr;
-  char * const eptr = bhandle->eptr;
-  struct bobject *object;
+bsize_t ambencode_symbol(struct bhandle *bhandle, const char *key,
+			 bsize_t len) {
 
-  poff_t first  = AMBENCODE_INVALID;
-  bsize_t count = 0;
+  struct bsymbol *slot;
+  size_t i;
 
-  bhandle->depth++;
-  
-  if (AM_UNLIKELY(eptr == ptr)) goto fail;
-  if ((*ptr == 'd') &&
-      (bhandle->depth < bhandle->max_depth)) {
+  if (!bhandle->symbols) return 0;
 
-    struct bobject *string;
-    struct bobject *value;
-    struct bobject *bobject;
+  for (i = bsymbol_hash(key, len) & bhandle->symbolmask; 
+       (slot = &bhandle->symbols[i])->key; 
+       i = (i + 1) & bhandle->symbolmask) {
 
-    poff_t last = AMBENCODE_INVALID;
+    struct bobject *bobject = BOBJECT_AT(bhandle, slot->key - 1);
 
-    ptr++;
+    if ((BOBJECT_STRING_LEN(bobject) == len) &&
+	(memcmp(BOBJECT_STRING_PTR(bhandle, bobject), key, len) == 0)) {
+      return slot->symbol;
+    }
+  }
 
-  nextobject:
+  return 0;
+}
 
-    if (AM_UNLIKELY(eptr == ptr)) goto fail;  
-    if (*ptr == 'e') {
-      ptr++;
-      goto success;
-    } 
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+bsize_t ambencode_intern_key(struct bhandle *bhandle, struct bobject *key) {
 
-    ambencode_string(bhandle, &ptr);
+  const char *ptr = BOBJECT_STRING_PTR(bhandle, key);
+  const bsize_t len = BOBJECT_STRING_LEN(key);
+  struct bsymbol *slot;
+  size_t i;
 
-    /* Add string to list */
-    count++;
-    
-    string = BOBJECT_LAST(bhandle);
-    if (count == 1) {
-      first = BOBJECT_OFFSET(bhandle, string);
-      last  = first;
-    } else {
-      bobject = BOBJECT_AT(bhandle, last);
-      bobject->next = BOBJECT_OFFSET(bhandle, string);
-      last = bobject->next;
+  /* Slots are doubled once half are used so probes stay short
+   */
+  if (AM_UNLIKELY((bhandle->symbolcount + 1) * 2 > bhandle->symbolmask + 1)) {
+    if (bsymbol_grow(bhandle) != 0) {
+      errno = ENOMEM;
+      return 0;
     }
-    /* String added */
-        
-    if (AM_UNLIKELY(eptr == ptr)) goto fail;
-    
-    ambencode_value(bhandle, &ptr);
-
-    /* Add value to list */
-    count++;
-    
-    value = BOBJECT_LAST(bhandle);
-    bobject = BOBJECT_AT(bhandle, last);
-    bobject->next = BOBJECT_OFFSET(bhandle, value);
-    last = bobject->next;
-    /* Value added */
-    
-    goto nextobject;
   }
 
-  goto fail;
+  for (i = bsymbol_hash(ptr, len) & bhandle->symbolmask; 
+       (slot = &bhandle->symbols[i])->key; 
+       i = (i + 1) & bhandle->symbolmask) {
 
- success:
-  
-  object = bobject_allocate(bhandle, 1);
- 
-  object->blen           = count | (AMBENCODE_DICTIONARY << AMBENCODE_LENBITS);
-  object->next           = AMBENCODE_INVALID;
-  object->u.object.child = first;
+    struct bobject *bobject = BOBJECT_AT(bhandle, slot->key - 1);
 
-  bhandle->depth--;
-  *optr = ptr;
-  return;  
+    if ((BOBJECT_STRING_LEN(bobject) == len) &&
+	(memcmp(BOBJECT_STRING_PTR(bhandle, bobject), ptr, len) == 0)) {
+      return BOBJECT_SYMBOL(bhandle, key) = slot->symbol;
+    }
+  }
 
- fail:
-  longjmp(bhandle->setjmp_ctx, 2); /* jump back to ambencode_decode() with EINVAL */
+  slot->key    = BOBJECT_OFFSET(bhandle, key) + 1;
+  slot->symbol = ++bhandle->symbolcount;
+
+  return BOBJECT_SYMBOL(bhandle, key) = slot->symbol;
 }
 
 /* -------------------------------------------------------------------- */
 /* -------------------------------------------------------------------- */
-static void ambencode_list(struct bhandle * const bhandle, char **optr) {
-
-  char *ptr = *optr;
-  char * const eptr = bhandle->eptr;
-  struct bobject *array;
+int bsymbol_release(struct bhandle * const bhandle, poff_t key) {
 
-  poff_t first  = AMBENCODE_INVALID;
-  bsize_t count = 0;
+  /* A slot compares the bytes of the first key given it's symbol, a key
+   * about to be changed hands the slot to a copy of itself appended to
+   * the pool. Return 0 on success, the pool may have moved, or -1.
+   */
+  struct bobject *bobject = BOBJECT_AT(bhandle, key);
+  struct bobject *copy;
+  size_t i;
 
-  bhandle->depth++;
+  for (i = bsymbol_hash(BOBJECT_STRING_PTR(bhandle, bobject),
+			BOBJECT_STRING_LEN(bobject)) & bhandle->symbolmask;
+       bhandle->symbols[i].key; 
+       i = (i + 1) & bhandle->symbolmask) {
 
-  if (AM_UNLIKELY(eptr == ptr)) goto fail;  
-  if ((*ptr == 'l') &&
-      (bhandle->depth < bhandle->max_depth)) {
+    if (bhandle->symbols[i].key != key + 1) continue;
 
-    struct bobject *value;
-    struct bobject *bobject;
-    poff_t last = AMBENCODE_INVALID;
-  
-    ptr++;
+    copy = bobject_allocate(bhandle, 1);
+    if (!copy) {
+      errno = ENOMEM;
+      return -1;
+    }
 
-  nextvalue:
+    bobject                     = BOBJECT_AT(bhandle, key);
+    copy->blen                  = bobject->blen;
+    BOBJECT_DATA(bhandle, copy) = BOBJECT_DATA(bhandle, bobject);
+    BOBJECT_LINK(bhandle, copy) = AMBENCODE_INVALID;
 
-    if (AM_UNLIKELY(eptr == ptr)) goto fail;  
-    if (*ptr == 'e') {
-      ptr++;
-      goto success;
-    } 
-    
-    ambencode_value(bhandle, &ptr);
+    BOBJECT_SYMBOL(bhandle, copy) = bhandle->symbols[i].symbol;
+    if (bhandle->span) BOBJECT_SPAN(bhandle, copy)->parent = 0;
 
-    /* Add value to list */
-    count++;
-    
-    value = BOBJECT_LAST(bhandle);
-    if (count == 1) {
-      first = BOBJECT_OFFSET(bhandle, value);
-      last  = first;
-    } else {
-      bobject = BOBJECT_AT(bhandle, last);
-      bobject->next = BOBJECT_OFFSET(bhandle, value);
-      last = bobject->next;
-    }
-    /* Value added */
-    
-    goto nextvalue;
+    bhandle->symbols[i].key = BOBJECT_OFFSET(bhandle, copy) + 1;
+    break;
   }
 
-  goto fail;
-
- success:
- 
-  array = bobject_allocate(bhandle, 1);
-  
-  array->blen           = count | (AMBENCODE_LIST << AMBENCODE_LENBITS);
-  array->next           = AMBENCODE_INVALID;
-  array->u.object.child = first;
-  
-  bhandle->depth--;
-  *optr = ptr;
-  return;  
-
- fail:
-  longjmp(bhandle->setjmp_ctx, 2); /* jump back to ambencode_decode() with EINVAL */
+  return 0;
 }
 
 /* -------------------------------------------------------------------- */
 /* -------------------------------------------------------------------- */
-static void ambencode_value(struct bhandle * const bhandle, char **optr) {
-  
-  char *ptr = *optr;
+int ambencode_spans(struct bhandle * const bhandle, int enable) {
 
-  if ((unsigned char)(*ptr - '0') < 10) {
-    ambencode_string(bhandle, &ptr);
-  } else if (*ptr == 'i') {
-    ambencode_number(bhandle, &ptr);
-  } else if (*ptr == 'd') {
-    ambencode_dictionary(bhandle, &ptr);
-  } else if (*ptr == 'l') {
-    ambencode_list(bhandle, &ptr);
-  } else {
-    goto fail;
+  if (bhandle->used) {
+    errno = EINVAL;
+    return -1;
   }
-  
-  *optr = ptr;
-  return;
 
- fail:
-  longjmp(bhandle->setjmp_ctx, 2); /* jump back to ambencode_decode() with EINVAL */
+  if (!enable) {
+    free(bhandle->span);
+    bhandle->span = (struct bspan *)0;
+    return 0;
+  }
+
+  if ((!bhandle->span) &&
+      (!(bhandle->span = (struct bspan *)malloc((size_t)bhandle->count * 
+						 sizeof(struct bspan))))) {
+    errno = ENOMEM;
+    return -1;
+  }
+
+  return 0;
 }
 
 /* -------------------------------------------------------------------- */
 /* -------------------------------------------------------------------- */
-static void ambencode_string(struct bhandle * const bhandle, char **optr) {
+void ambencode_touch(struct bhandle *bhandle, struct bobject *bobject) {
 
-  char *ptr = *optr;
-  char * const eptr = bhandle->eptr;
-  struct bobject *bobject;
-  bsize_t len;
-  char *str;
-  size_t value = 0;
-  
-  if (AM_UNLIKELY(eptr == ptr)) goto fail;
-  if (*ptr == '0') {
-    ptr++;
+  /* A container whose span is already forgotten is held by containers
+   * that were forgotten with it
+   */
+  struct bspan * const span = bhandle->span;
+  poff_t offset;
 
-    if (AM_UNLIKELY(eptr == ptr)) goto fail;
-    if (*ptr == ':') {
-      ptr++;
-      str = ptr;
-      goto success;
-    }
+  if (!span) return;
 
-  } else if ((unsigned char)(*ptr - '1') < 9) {
-    value *= 10;
-    value += (unsigned char)(*ptr - '0');
-    ptr++;
-    
-  nextdigit:
-    
-    if (AM_UNLIKELY(eptr == ptr)) goto fail;  
-    if ((unsigned char)(*ptr - '0') < 10) {
-      value *= 10;
-      value += (unsigned char)(*ptr - '0');
-      ptr++;
-      
-      goto nextdigit;
-    }
+  offset = BOBJECT_OFFSET(bhandle, bobject);
+  if (BOBJECT_TYPE(bobject) <= AMBENCODE_LIST) span[offset].len = 0;
 
-    if (AM_UNLIKELY(eptr == ptr)) goto fail;  
-    if (*ptr == ':') {
-      ptr++;
-      str = ptr;
+  for (offset = span[offset].parent; (offset) && (span[offset - 1].len);
+       offset = span[offset - 1].parent) {
+    span[offset - 1].len = 0;
+  }
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static void bobject_span(struct bhandle * const bhandle, 
+			 struct bobject * const bobject, const char * const end) {
+
+  /* Record the span of a container just decoded that ends before end.
+   * It begins a byte before it's first child, whose own start is found
+   * from it's span or from the digits and length prefix that canonical
+   * BENCODE gives it, and an empty container begins two bytes before 
+   * end
+   */
+  struct bspan * const span = BOBJECT_SPAN(bhandle, bobject);
+  struct bobject *child;
+  bsize_t len;
 
-      ptr += value;
-      if (ptr > eptr) goto fail;
+  if (LIST_COUNT(bobject) == 0) {
+    span->ptr = end - 2;
+  } else {
 
-      goto success;
+    child = BOBJECT_AT(bhandle, BOBJECT_CHILD(bhandle, bobject));
+
+    switch (BOBJECT_TYPE(child)) {
+    case AMBENCODE_STRING:
+      span->ptr = BOBJECT_STRING_PTR(bhandle, child) - 3;
+      for (len = BOBJECT_STRING_LEN(child); len >= 10; len /= 10) span->ptr--;
+      break;
+    case AMBENCODE_NUMBER:
+      span->ptr = BOBJECT_STRING_PTR(bhandle, child) - 2;
+      break;
+    default:
+      span->ptr = BOBJECT_SPAN(bhandle, child)->ptr - 1;
+      break;
     }
   }
 
-  goto fail;
+  span->len = end - span->ptr;
 
- success:
+  bobject_parent(bhandle, bobject);
+}
 
-  len = value;
-  if (len > AMBENCODE_MAXSTR) goto fail; 
-  
-  bobject = bobject_allocate(bhandle, 1);
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static void bobject_parent(struct bhandle * const bhandle, 
+			   struct bobject * const bobject) {
 
-  bobject->blen            = len | (AMBENCODE_STRING << AMBENCODE_LENBITS);
-  bobject->next            = AMBENCODE_INVALID;
-  bobject->u.string.offset = (str) - bhandle->buf;
+  /* Record a container just decoded as the parent of each of it's 
+   * children, keys included
+   */
+  const poff_t parent = BOBJECT_OFFSET(bhandle, bobject) + 1;
+  bsize_t count = LIST_COUNT(bobject);
+  poff_t child;
 
-  *optr = ptr;
-  return;
+  if (count == 0) return;
 
- fail:
-  longjmp(bhandle->setjmp_ctx, 2); /* jump back to ambencode_decode() with EINVAL */
+  for (child = BOBJECT_CHILD(bhandle, bobject); ; 
+       child = BOBJECT_LINK(bhandle, BOBJECT_AT(bhandle, child))) {
+    bhandle->span[child].parent = parent;
+    if (--count == 0) break;
+  }
 }
 
 /* -------------------------------------------------------------------- */
 /* -------------------------------------------------------------------- */
-static void ambencode_number(struct bhandle * const bhandle, char **optr) {
+static void bobject_document(struct bhandle * const bhandle, poff_t value) {
 
-  char *ptr = *optr;
-  char * const eptr = bhandle->eptr;
-  struct bobject *bobject;
-  bsize_t len;
-  char *str = (char *)0;
+  /* Values outside of any container are linked in the order they
+   * appear, root is always the last.
+   */
+  if (bhandle->documents++) {
+    BOBJECT_LINK(bhandle, BOBJECT_AT(bhandle, bhandle->root)) = value;
+  } else {
+    bhandle->first = value;
+  }
+  bhandle->root = value;
 
-  if (AM_UNLIKELY(eptr == ptr)) goto fail;
-  if (*ptr == 'i') {
-    ptr++;
+  if (bhandle->span) bhandle->span[value].parent = 0;
+}
 
-    if (AM_UNLIKELY(eptr == ptr)) goto fail;  
-    if (*ptr == '-') {
-      str = ptr;
-      ptr++;
-    }
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static int bobject_intern(struct bhandle * const bhandle, poff_t key,
+			  bsize_t count) {
 
-    if (AM_UNLIKELY(eptr == ptr)) goto fail;  
-    if (*ptr == '0') {
-      if (!str) str = ptr;
-      ptr++;
+  /* Intern the count / 2 keys of a dictionary that has just been 
+   * decoded, key is the offset of it's first
+   */
+  for (; count; count -= 2) {
+
+    struct bobject *bobject = BOBJECT_AT(bhandle, key);
+
+    if (AM_UNLIKELY(ambencode_intern_key(bhandle, bobject) == 0)) return DECODE_ENOMEM;
+    key = BOBJECT_LINK(bhandle, BOBJECT_AT(bhandle, BOBJECT_LINK(bhandle, bobject)));
+  }
+
+  return DECODE_OK;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static int bsymbol_grow(struct bhandle * const bhandle) {
+
+  /* Double the slots rehashing every interned key
+   */
+  const size_t slots = (bhandle->symbolmask + 1) * 2;
+  struct bsymbol *symbols = (struct bsymbol *)calloc(slots, sizeof(struct bsymbol));
+  size_t i, j;
+
+  if (!symbols) return -1;
+
+  for (i = 0; i <= bhandle->symbolmask; i++) {
+
+    struct bsymbol *slot = &bhandle->symbols[i];
+    struct bobject *bobject;
+
+    if (!slot->key) continue;
+
+    bobject = BOBJECT_AT(bhandle, slot->key - 1);
+    for (j = bsymbol_hash(BOBJECT_STRING_PTR(bhandle, bobject), 
+			  BOBJECT_STRING_LEN(bobject)) & (slots - 1);
+	 symbols[j].key; j = (j + 1) & (slots - 1));
+
+    symbols[j] = *slot;
+  }
+
+  free(bhandle->symbols);
+  bhandle->symbols    = symbols;
+  bhandle->symbolmask = slots - 1;
+  return 0;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static size_t bsymbol_hash(const char *ptr, bsize_t len) {
+
+  /* FNV-1a
+   */
+  uint32_t hash = 2166136261U;
+
+  while (len--) {
+    hash ^= (unsigned char)*ptr++;
+    hash *= 16777619U;
+  }
+
+  return (size_t)hash;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+void ambencode_free(struct bhandle *bhandle) {
+
+#ifdef AM_MREMAP
+  if (bhandle->mapped) {
+    munmap(bhandle->bobject, (size_t)bhandle->count * sizeof(struct bobject));
+  } else
+#endif
+  if (!bhandle->userbuffer) {
+    free(bhandle->bobject);
+  }
+
+#ifdef AMBENCODE_SOA
+  free(bhandle->data);
+  free(bhandle->link);
+#endif
+
+  bfind_free(bhandle);
+  free(bhandle->integer);
+  free(bhandle->symbol);
+  free(bhandle->symbols);
+  free(bhandle->span);
+  free(bhandle->stack);
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+void ambencode_reset(struct bhandle * const bhandle) {
+
+  /* Every SHRINK_RESETS a managed pool more than four times larger than
+   * the most used since the last check is shrunk, so that one large
+   * document does not hold on to memory for the life of the handle.
+   */
+  if (bhandle->used > bhandle->peak) bhandle->peak = bhandle->used;
+
+  if (++bhandle->resets == SHRINK_RESETS) {
+
+    if ((!bhandle->userbuffer) && (bhandle->count / 4 > bhandle->peak)) {
+
+      poff_t ncount = (bhandle->peak * 2 < BOBJECT_P)?BOBJECT_P:bhandle->peak * 2;
+
+      bobject_resize(bhandle, ncount);
+    }
+
+    bhandle->peak   = 0;
+    bhandle->resets = 0;
+  }
+
+  bhandle->buf   = (char *)0;
+  bhandle->eptr  = (char *)0;
+  bhandle->len   = 0;
+  bhandle->used  = 0;
+  bhandle->root  = AMBENCODE_INVALID;
+  bhandle->first = AMBENCODE_INVALID;
+  bhandle->depth = 0;
+  bhandle->tape  = 0;
+
+  bhandle->documents = 0;
+
+  /* Key indexes and interned keys refer to bobjects that are no longer
+   * valid
+   */
+  bfind_free(bhandle);
+
+  if (bhandle->symbols) {
+    memset(bhandle->symbols, 0, (bhandle->symbolmask + 1) * sizeof(struct bsymbol));
+    bhandle->symbolcount = 0;
+  }
+
+  memset(&bhandle->feed, 0, sizeof(bhandle->feed));
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+int ambencode_decode(struct bhandle * const bhandle, char *buf, xbsize_t len) {
+
+  char *ptr = buf;
+
+  bhandle->buf       = buf;
+  bhandle->len       = len;
+  bhandle->eptr      = &buf[len];
+  bhandle->depth     = 0;
+  bhandle->documents = 0;
+  bhandle->tape      = 0;
+
+  bobject_expect(bhandle, len);
+
+  switch (ambencode_document(bhandle, &ptr)) {
+
+  case DECODE_OK:
+    break;
+
+  case DECODE_ENOMEM:
+    /* We returned from calling ambencode_document() with an 
+     * allocation failure.
+     */
+    errno = ENOMEM;
+    return -1;
+
+  default:
+    /* We returned from calling ambencode_document() with an 
+     * parser failure.
+     */
+    errno = EINVAL;
+    return -1;
+  }
+
+  bobject_learn(bhandle, len);
+  return 0;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+int ambencode_decode_tape(struct bhandle * const bhandle, char *buf,
+			  xbsize_t len, int flags) {
+
+  char *ptr = buf;
+
+  bhandle->buf       = buf;
+  bhandle->len       = len;
+  bhandle->eptr      = &buf[len];
+  bhandle->depth     = 0;
+  bhandle->documents = 0;
+  bhandle->tape      = 1;
+  bhandle->tapeindex = (flags & AMBENCODE_TAPE_INDEX)?1:0;
+
+  bobject_expect(bhandle, len);
+
+  switch (ambencode_tape(bhandle, &ptr)) {
+
+  case DECODE_OK:
+    break;
+
+  case DECODE_ENOMEM:
+    errno = ENOMEM;
+    return -1;
+
+  default:
+    errno = EINVAL;
+    return -1;
+  }
+
+  bobject_learn(bhandle, len);
+  return 0;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+int ambencode_decode_select(struct bhandle * const bhandle, char *buf,
+			    xbsize_t len, const struct bselect *select, void *ctx) {
+
+  char *ptr = buf;
+
+  bhandle->buf       = buf;
+  bhandle->len       = len;
+  bhandle->eptr      = &buf[len];
+  bhandle->depth     = 0;
+  bhandle->documents = 0;
+  bhandle->tape      = 0;
+
+  /* The pool is not sized from, nor does it teach, the bobjects per 
+   * byte of a full decode
+   */
+  switch (ambencode_select(bhandle, &ptr, select, ctx)) {
+
+  case DECODE_OK:
+    break;
+
+  case DECODE_ENOMEM:
+    errno = ENOMEM;
+    return -1;
+
+  default:
+    errno = EINVAL;
+    return -1;
+  }
+
+  /* Every document was skipped, there is no root
+   */
+  if (bhandle->documents == 0) {
+    errno = ENOENT;
+    return -1;
+  }
+
+  return 0;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+int ambencode_feed(struct bhandle * const bhandle, char *buf, xbsize_t len) {
+
+  struct bfeed * const feed = &bhandle->feed;
+  struct bframe * const stack = (bhandle->stack)?bhandle->stack:bhandle->frames;
+  struct bframe *frame = &stack[bhandle->depth];
+  struct bobject *bobject;
+  char *ptr = buf;
+  char * const eptr = &buf[len];
+  int depth = bhandle->depth;
+  int rc = DECODE_EINVAL;
+  size_t n;
+
+  /* Unlike ambencode_document() any byte may be the last of a chunk, 
+   * the innermost container is therefore kept on the container stack 
+   * and length prefixes and numbers are converted a byte at a time.
+   */
+  bhandle->len += len;
+
+  switch (feed->state) {
+  case FEED_VALUE:  goto value;
+  case FEED_LENGTH: goto length;
+  case FEED_STRING: goto string;
+  case FEED_NUMBER: goto number;
+  default:          goto fail;
+  }
+
+ value:
+  if (AM_UNLIKELY(eptr == ptr)) {
+    feed->state = FEED_VALUE;
+    goto more;
+  }
+
+  if ((depth) && (frame->type == AMBENCODE_DICTIONARY) && !(frame->count & 1)) {
+
+    /* Dictionary keys must be strings
+     */
+    switch (BCLASS(*ptr)) {
+    case BCLASS_ZERO:
+    case BCLASS_DIGIT:      goto prefix;
+    case BCLASS_END:        goto end;
+    default:                goto fail;
+    }
+  }
+
+  switch (BCLASS(*ptr)) {
+  case BCLASS_ZERO:
+  case BCLASS_DIGIT:      goto prefix;
+  case BCLASS_INTEGER:    goto integer;
+  case BCLASS_DICTIONARY: 
+  case BCLASS_LIST:       goto push;
+  case BCLASS_END:
+    if ((depth) && (frame->type == AMBENCODE_LIST)) goto end;
+    goto fail;
+  default:                goto fail;
+  }
+
+ prefix:
+  feed->length = 0;
+  feed->digits = 0;
+
+ length:
+
+  /* The length prefix must be terminated by ':', may only have a leading
+   * zero when it is zero and must fit in AMBENCODE_MAXSTR.
+   */
+  for (; ptr != eptr; ptr++) {
+
+    switch (BCLASS(*ptr)) {
+    case BCLASS_COLON:
+      goto data;
+    case BCLASS_ZERO:
+    case BCLASS_DIGIT:
+      break;
+    default:
+      goto fail;
+    }
+
+    if (AM_UNLIKELY((feed->digits == 1) && (feed->length == 0))) goto fail;
+    if (AM_UNLIKELY(++feed->digits > 16)) goto fail;
+
+    feed->length = (feed->length * 10) + (*ptr - '0');
+  }
+
+  feed->state = FEED_LENGTH;
+  goto more;
+
+ data:
+  ptr++;
+  if (AM_UNLIKELY(feed->length > AMBENCODE_MAXSTR)) goto fail;
+
+  rc = bobject_data(bhandle, (size_t)feed->length, &feed->data);
+  if (AM_UNLIKELY(rc != DECODE_OK)) goto fail;
+  feed->remaining = feed->length;
+
+ string:
+
+  /* Copy as much of the string data as this chunk holds
+   */
+  n = (size_t)(eptr - ptr);
+  if (n > feed->remaining) n = (size_t)feed->remaining;
+
+  memcpy((char *)&bhandle->bobject[feed->data] + 
+	 (feed->length - feed->remaining), ptr, n);
+  ptr             += n;
+  feed->remaining -= n;
+
+  if (feed->remaining) {
+    feed->state = FEED_STRING;
+    goto more;
+  }
+
+  bobject = bobject_allocate(bhandle, 1);
+  if (AM_UNLIKELY(!bobject)) {
+    rc = DECODE_ENOMEM;
+    goto fail;
+  }
+
+  bobject->blen                                = (bsize_t)feed->length | AMBENCODE_STRBUFMASK |
+                                                 (AMBENCODE_STRING << AMBENCODE_LENBITS);
+  BOBJECT_LINK(bhandle, bobject)               = AMBENCODE_INVALID;
+  BOBJECT_DATA(bhandle, bobject).string.offset = feed->data;
+  goto complete;
+
+ integer:
+  ptr++;
+  feed->digits = 0;
+
+ number:
+
+  /* An optional '-' then at least one digit terminated by 'e', a leading
+   * zero is only allowed for zero and at most 19 characters including
+   * any sign.
+   */
+  for (; ptr != eptr; ptr++) {
+
+    switch (BCLASS(*ptr)) {
+    case BCLASS_END:
+      goto copy;
+    case BCLASS_MINUS:
+      if (AM_UNLIKELY(feed->digits)) goto fail;
+      break;
+    case BCLASS_ZERO:
+    case BCLASS_DIGIT:
+      if (AM_UNLIKELY((feed->digits) &&
+		      (feed->digits == 1 + (feed->number[0] == '-')) &&
+		      (feed->number[feed->digits - 1] == '0'))) goto fail;
+      break;
+    default:
+      goto fail;
+    }
+    if (AM_UNLIKELY(feed->digits == 19)) goto fail;
+
+    feed->number[feed->digits++] = *ptr;
+  }
+
+  feed->state = FEED_NUMBER;
+  goto more;
+
+ copy:
+  ptr++;
+  if (AM_UNLIKELY(feed->digits == 0)) goto fail;
+  if (AM_UNLIKELY(feed->number[feed->digits - 1] == '-')) goto fail;
+
+  rc = bobject_data(bhandle, (size_t)feed->digits, &feed->data);
+  if (AM_UNLIKELY(rc != DECODE_OK)) goto fail;
+
+  memcpy(&bhandle->bobject[feed->data], feed->number, feed->digits);
+
+  bobject = bobject_allocate(bhandle, 1);
+  if (AM_UNLIKELY(!bobject)) {
+    rc = DECODE_ENOMEM;
+    goto fail;
+  }
+
+  bobject->blen                                = (bsize_t)feed->digits | AMBENCODE_STRBUFMASK |
+                                                 (AMBENCODE_NUMBER << AMBENCODE_LENBITS);
+  BOBJECT_LINK(bhandle, bobject)               = AMBENCODE_INVALID;
+  BOBJECT_DATA(bhandle, bobject).string.offset = feed->data;
+
+  if (bhandle->integer) {
+    BOBJECT_INT64(bhandle, bobject) = ambencode_i64(feed->number, (size_t)feed->digits,
+						    &feed->number[feed->digits]);
+  }
+  goto complete;
+
+ push:
+  if (AM_UNLIKELY(depth + 1 >= bhandle->max_depth)) goto fail;
+
+  frame = &stack[++depth];
+  frame->first = AMBENCODE_INVALID;
+  frame->last  = AMBENCODE_INVALID;
+  frame->count = 0;
+  frame->type  = (*ptr == 'd')?AMBENCODE_DICTIONARY:AMBENCODE_LIST;
+
+  ptr++;
+  goto value;
+
+ end:
+  ptr++;
+
+  bobject = bobject_allocate(bhandle, 1);
+  if (AM_UNLIKELY(!bobject)) {
+    rc = DECODE_ENOMEM;
+    goto fail;
+  }
+
+  bobject->blen                               = frame->count | (frame->type << AMBENCODE_LENBITS);
+  BOBJECT_LINK(bhandle, bobject)              = AMBENCODE_INVALID;
+  BOBJECT_DATA(bhandle, bobject).object.child = frame->first;
+
+  if ((frame->type == AMBENCODE_DICTIONARY) && (bhandle->symbol) &&
+      (AM_UNLIKELY((rc = bobject_intern(bhandle, frame->first, frame->count)) != DECODE_OK))) {
+    goto fail;
+  }
+
+  /* Strings have been copied, the chunks they came from are gone
+   */
+  if (bhandle->span) {
+    BOBJECT_SPAN(bhandle, bobject)->len = 0;
+    bobject_parent(bhandle, bobject);
+  }
+
+  frame = &stack[--depth];
+
+ complete:
+
+  /* The value just completed is the last bobject allocated
+   */
+  if (depth == 0) {
+    if (bhandle->documents++) {
+      BOBJECT_LINK(bhandle, BOBJECT_AT(bhandle, bhandle->root)) = bhandle->used - 1;
+    } else {
+      bhandle->first = bhandle->used - 1;
+    }
+    bhandle->root  = bhandle->used - 1;
+    feed->complete = 1;
+
+    if (bhandle->span) bhandle->span[bhandle->root].parent = 0;
+    goto value;
+  }
+
+  if (AM_UNLIKELY(frame->count == AMBENCODE_LENMASK)) goto fail;
+
+  if (frame->count == 0) {
+    frame->first = bhandle->used - 1;
+  } else {
+    BOBJECT_LINK(bhandle, BOBJECT_AT(bhandle, frame->last)) = bhandle->used - 1;
+  }
+  frame->last = bhandle->used - 1;
+  frame->count++;
+  goto value;
+
+ more:
+  bhandle->depth = depth;
+  return 0;
+
+ fail:
+  bhandle->depth = depth;
+  feed->state    = FEED_FAIL;
+
+  errno = (rc == DECODE_ENOMEM)?ENOMEM:EINVAL;
+  return -1;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+int ambencode_feed_end(struct bhandle * const bhandle) {
+
+  /* Only a complete value outside of any container is accepted
+   */
+  if ((bhandle->feed.state == FEED_VALUE) && (bhandle->depth == 0) &&
+      (bhandle->feed.complete)) {
+
+    bobject_learn(bhandle, bhandle->len);
+    return 0;
+  }
+
+  errno = EINVAL;
+  return -1;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+int ambencode_parse_events(struct bhandle * const bhandle, char *buf,
+			   xbsize_t len, const struct bevents * const events,
+			   void *ctx) {
+
+  struct bframe frames[AMBENCODE_MAXDEPTH];
+  struct berror error;
+  int rc;
+
+  if (bhandle) {
+    rc = ambencode_walk((bhandle->stack)?bhandle->stack:bhandle->frames,
+			bhandle->max_depth, 0, buf, len, (char **)0, events, ctx,
+			&error, (uint64_t *)0);
+  } else {
+    rc = ambencode_walk(frames, AMBENCODE_MAXDEPTH, 0, buf, len, (char **)0,
+			events, ctx, &error, (uint64_t *)0);
+  }
+
+  if (rc == 0) return 0;
+
+  errno = rc;
+  return -1;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+int ambencode_validate(struct bhandle * const bhandle, char *buf,
+		       xbsize_t len, struct berror * const error) {
+
+  static const struct bevents events = { 0, 0, 0, 0, 0, 0 };
+  struct bframe frames[AMBENCODE_MAXDEPTH];
+  int rc;
+
+  if (bhandle) {
+    rc = ambencode_walk((bhandle->stack)?bhandle->stack:bhandle->frames,
+			bhandle->max_depth, 0, buf, len, (char **)0, &events,
+			(void *)0, error, (uint64_t *)0);
+  } else {
+    rc = ambencode_walk(frames, AMBENCODE_MAXDEPTH, 0, buf, len, (char **)0,
+			&events, (void *)0, error, (uint64_t *)0);
+  }
+
+  if (rc == 0) return 0;
+
+  errno = rc;
+  return -1;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+int ambencode_count(struct bhandle * const bhandle, char *buf,
+		    xbsize_t len, poff_t * const count) {
+
+  static const struct bevents events = { 0, 0, 0, 0, 0, 0 };
+  struct bframe frames[AMBENCODE_MAXDEPTH];
+  struct berror error;
+  uint64_t values;
+  int rc;
+
+  if (bhandle) {
+    rc = ambencode_walk((bhandle->stack)?bhandle->stack:bhandle->frames,
+			bhandle->max_depth, 0, buf, len, (char **)0, &events,
+			(void *)0, &error, &values);
+  } else {
+    rc = ambencode_walk(frames, AMBENCODE_MAXDEPTH, 0, buf, len, (char **)0,
+			&events, (void *)0, &error, &values);
+  }
+
+  if (rc != 0) {
+    errno = rc;
+    return -1;
+  }
+
+  /* Every value decodes to exactly one bobject
+   */
+  if (values >= POFF_MAX) {
+    errno = ENOMEM;
+    return -1;
+  }
+
+  *count = (poff_t)(values + 1);
+  return 0;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+const char *ambencode_strerror(int error) {
+
+  static const char * const errors[] = {
+    "no error",
+    "data ends before the value is complete",
+    "string data extends past the end of the buffer",
+    "bad length prefix",
+    "leading zero",
+    "bad integer",
+    "dictionary key is not a string",
+    "byte cannot start a value",
+    "maximum depth exceeded",
+    "too many values in list or dictionary"
+  };
+
+  if ((error < 0) || 
+      (error >= (int)(sizeof(errors) / sizeof(errors[0])))) {
+    return "unknown error";
+  }
+
+  return errors[error];
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static int ambencode_cursor_fail(struct bcursor * const cursor) {
+
+  /* Invalid BENCODE, every later call fails
+   */
+  cursor->failed = (unsigned int)1;
+
+  errno = EINVAL;
+  return -1;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static int ambencode_cursor_member(struct bcursor * const cursor) {
+
+  /* cursor->ptr has moved to the next member of a container, to the 'e'
+   * ending it or past the last document. The key of a dictionary member
+   * is read so that cursor->ptr is left at it's value.
+   */
+  char *ptr = cursor->ptr;
+  char * const eptr = cursor->eptr;
+  struct blevel *level;
+  size_t slen;
+  char *str;
+
+  cursor->vend   = (char *)0;
+  cursor->key    = (char *)0;
+  cursor->keylen = 0;
+
+  if (cursor->depth == 0) {
+    if (eptr == ptr) goto end;
+
+    cursor->atend = 0;
+    return 0;
+  }
+
+  if (AM_UNLIKELY(eptr == ptr)) goto fail;
+  if (*ptr == 'e') goto end;
+
+  level = &cursor->level[cursor->depth - 1];
+  if (level->type == AMBENCODE_DICTIONARY) {
+    if ((BCLASS(*ptr) != BCLASS_ZERO) && 
+	(BCLASS(*ptr) != BCLASS_DIGIT)) goto fail;
+
+    str = ambencode_scan_string(ptr, eptr, &slen);
+    if (AM_UNLIKELY(!str)) goto fail;
+
+    ptr = str + slen;
+    if (AM_UNLIKELY((eptr == ptr) || (*ptr == 'e'))) goto fail;
+
+    cursor->ptr    = ptr;
+    cursor->key    = str;
+    cursor->keylen = (bsize_t)slen;
+  }
+
+  cursor->atend = 0;
+  return 0;
+
+ end:
+  cursor->atend = (unsigned int)1;
+
+  errno = ENOENT;
+  return -1;
+
+ fail:
+  return ambencode_cursor_fail(cursor);
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static char *ambencode_cursor_end(struct bcursor * const cursor) {
+
+  /* Return a pointer past the current value, validating it if it has 
+   * not been read, otherwise (char *)0
+   */
+  static const struct bevents skip = { 0, 0, 0, 0, 0, 0 };
+  struct berror error;
+  char *ptr = cursor->ptr;
+
+  if (cursor->vend) return cursor->vend;
+
+  if (ambencode_walk(cursor->frames, AMBENCODE_MAXDEPTH, cursor->depth,
+		     cursor->buf, (xbsize_t)(cursor->eptr - cursor->buf), &ptr,
+		     &skip, (void *)0, &error, (uint64_t *)0)) {
+    return (char *)0;
+  }
+
+  return cursor->vend = ptr;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+int ambencode_cursor_init(struct bcursor *cursor, char *buf, xbsize_t len) {
+
+  cursor->buf    = buf;
+  cursor->eptr   = buf + len;
+  cursor->ptr    = buf;
+  cursor->vend   = (char *)0;
+  cursor->key    = (char *)0;
+  cursor->keylen = 0;
+  cursor->atend  = 0;
+  cursor->failed = 0;
+  cursor->depth  = 0;
+
+  if (len == 0) return ambencode_cursor_fail(cursor);
+  return 0;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+int ambencode_cursor_next(struct bcursor *cursor) {
+
+  char *ptr;
+
+  if (AM_UNLIKELY(cursor->failed)) goto fail;
+  if (cursor->atend) {
+    errno = ENOENT;
+    return -1;
+  }
+
+  if (AM_UNLIKELY((ptr = ambencode_cursor_end(cursor)) == (char *)0)) goto fail;
+
+  cursor->ptr = ptr;
+  if (cursor->depth) cursor->level[cursor->depth - 1].index++;
+
+  return ambencode_cursor_member(cursor);
+
+ fail:
+  return ambencode_cursor_fail(cursor);
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+int ambencode_cursor_type(struct bcursor *cursor) {
+
+  if (AM_UNLIKELY(cursor->failed)) goto fail;
+  if (cursor->atend) {
+    errno = ENOENT;
+    return -1;
+  }
+
+  switch (BCLASS(*cursor->ptr)) {
+  case BCLASS_ZERO:
+  case BCLASS_DIGIT:      return AMBENCODE_STRING;
+  case BCLASS_INTEGER:    return AMBENCODE_NUMBER;
+  case BCLASS_DICTIONARY: return AMBENCODE_DICTIONARY;
+  case BCLASS_LIST:       return AMBENCODE_LIST;
+  default:                break;
+  }
+
+ fail:
+  return ambencode_cursor_fail(cursor);
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+int ambencode_cursor_enter(struct bcursor *cursor) {
+
+  struct blevel *level;
+  int type;
+
+  if ((type = ambencode_cursor_type(cursor)) == -1) return -1;
+  if ((type != AMBENCODE_DICTIONARY) && (type != AMBENCODE_LIST)) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (AM_UNLIKELY(cursor->depth + 1 >= AMBENCODE_MAXDEPTH)) {
+    return ambencode_cursor_fail(cursor);
+  }
+
+  level         = &cursor->level[cursor->depth++];
+  level->open   = cursor->ptr;
+  level->key    = cursor->key;
+  level->keylen = cursor->keylen;
+  level->index  = 0;
+  level->type   = type;
+
+  cursor->ptr++;
+  return ambencode_cursor_member(cursor);
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+int ambencode_cursor_leave(struct bcursor *cursor) {
+
+  struct blevel *level;
+
+  if (AM_UNLIKELY(cursor->failed)) return ambencode_cursor_fail(cursor);
+  if (cursor->depth == 0) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  /* Skip to the 'e' ending the container
+   */
+  while (!cursor->atend) {
+    if (ambencode_cursor_next(cursor) && cursor->failed) return -1;
+  }
+
+  level = &cursor->level[--cursor->depth];
+
+  cursor->vend   = cursor->ptr + 1;
+  cursor->ptr    = level->open;
+  cursor->key    = level->key;
+  cursor->keylen = level->keylen;
+  cursor->atend  = 0;
+
+  return 0;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+int ambencode_cursor_find_key(struct bcursor *cursor, const char *key,
+			      bsize_t len) {
+
+  struct blevel *level;
+  char *ptr, *vend, *mkey;
+  bsize_t mkeylen, index;
+  unsigned int atend;
+
+  if (AM_UNLIKELY(cursor->failed)) return ambencode_cursor_fail(cursor);
+  if ((cursor->depth == 0) || 
+      (cursor->level[cursor->depth - 1].type != AMBENCODE_DICTIONARY)) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  level   = &cursor->level[cursor->depth - 1];
+  ptr     = cursor->ptr;
+  vend    = cursor->vend;
+  mkey    = cursor->key;
+  mkeylen = cursor->keylen;
+  atend   = cursor->atend;
+  index   = level->index;
+
+  /* From the current member to the end of the dictionary
+   */
+  while (!cursor->atend) {
+    if ((cursor->keylen == len) && 
+	(memcmp(cursor->key, key, (size_t)len) == 0)) return 0;
+
+    if (ambencode_cursor_next(cursor) && cursor->failed) return -1;
+  }
+
+  /* Then from the first member to the one we started at, these have 
+   * already been validated and are passed over without checking
+   */
+  cursor->ptr = level->open + 1;
+
+  for (level->index = 0; level->index < index; level->index++) {
+    bsize_t klen = 0;
+
+    while (*cursor->ptr != ':') klen = (klen * 10) + (bsize_t)(*cursor->ptr++ - '0');
+    cursor->ptr++;
+
+    if ((klen == len) && (memcmp(cursor->ptr, key, (size_t)len) == 0)) {
+      cursor->key    = cursor->ptr;
+      cursor->keylen = klen;
+      cursor->ptr   += klen;
+      cursor->vend   = (char *)0;
+      cursor->atend  = 0;
+      return 0;
+    }
+    cursor->ptr = ambencode_pass(cursor->ptr + klen);
+  }
+
+  cursor->ptr    = ptr;
+  cursor->vend   = vend;
+  cursor->key    = mkey;
+  cursor->keylen = mkeylen;
+  cursor->atend  = atend;
+  level->index   = index;
+
+  errno = ENOENT;
+  return -1;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+int ambencode_cursor_get_int(struct bcursor *cursor, int64_t *value) {
+
+  int64_t result;
+  size_t slen;
+  char *str;
+  int type;
+
+  if ((type = ambencode_cursor_type(cursor)) == -1) return -1;
+  if (type != AMBENCODE_NUMBER) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  str = ambencode_scan_number(cursor->ptr, cursor->eptr, &slen);
+  if (AM_UNLIKELY(!str)) return ambencode_cursor_fail(cursor);
+
+  cursor->vend = str + slen + 1;
+
+  if ((result = ambencode_i64(str, slen, cursor->eptr)) == AMBENCODE_BIGINTEGER) {
+    errno = ERANGE;
+    return -1;
+  }
+
+  *value = result;
+  return 0;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+int ambencode_cursor_get_string(struct bcursor *cursor, char **ptr,
+				bsize_t *len) {
+
+  size_t slen;
+  char *str;
+  int type;
+
+  if ((type = ambencode_cursor_type(cursor)) == -1) return -1;
+  if (type != AMBENCODE_STRING) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  str = ambencode_scan_string(cursor->ptr, cursor->eptr, &slen);
+  if (AM_UNLIKELY(!str)) return ambencode_cursor_fail(cursor);
+
+  cursor->vend = str + slen;
+
+  *ptr = str;
+  *len = (bsize_t)slen;
+  return 0;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+
+/* BGRAMMAR hooks of ambencode_walk(), the error class of a string or
+ * integer is only worked out once it has failed to scan.
+ */
+#define WALK_FAIL(c)          { code = (c); goto fail; }
+#define WALK_DOCUMENT
+#define WALK_KEY              WALK_SCAN(key)
+#define WALK_STRING           WALK_SCAN(string)
+#define WALK_SCAN(event)                                                      \
+  str = ambencode_scan_string(ptr, eptr, &slen);                              \
+  if (AM_UNLIKELY(!str)) WALK_FAIL(ambencode_string_error(&ptr, eptr));       \
+  if ((events->event) && (events->event(ctx, str, (bsize_t)slen))) goto cancel; \
+  ptr = str + slen;
+#define WALK_NUMBER                                                           \
+  str = ambencode_scan_number(ptr, eptr, &slen);                              \
+  if (AM_UNLIKELY(!str)) WALK_FAIL(ambencode_number_error(&ptr, eptr));       \
+  if ((events->integer) && (events->integer(ctx, str, (bsize_t)slen))) goto cancel; \
+  ptr = str + slen + 1;
+#define WALK_OPEN                                                             \
+  if (*ptr == 'd') {                                                          \
+    if ((events->dictionary_start) && (events->dictionary_start(ctx))) goto cancel; \
+  } else if ((events->list_start) && (events->list_start(ctx))) goto cancel;
+#define WALK_SAVE(frame)
+#define WALK_RESET
+#define WALK_RESTORE(frame)
+#define WALK_COMPLETE         completed++;
+#define WALK_TOP
+#define WALK_CHILD
+#define WALK_MEMBER
+#define WALK_CLOSE            if ((events->end) && (events->end(ctx))) goto cancel;
+#define WALK_SETTLED          if (optr) goto done;
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static int ambencode_walk(struct bframe * const stack, const int max_depth,
+			  const int base, char *buf, xbsize_t len, 
+			  char ** const optr, const struct bevents * const events,
+			  void *ctx, struct berror * const error,
+			  uint64_t * const values) {
+
+  /* BGRAMMAR with each value reported to a callback instead of
+   * allocating a bobject, nothing is written other than the container
+   * stack above base. The error class and offset are only worked out
+   * once the buffer has been found to be invalid. Values are counted as
+   * they complete, a count is only returned on success.
+   *
+   * Given optr a single value is walked from *optr inside containers
+   * already open to depth base, *optr is moved past it on success. This
+   * is how ambencode_select() and the cursor skip a value.
+   */
+  char *ptr = (optr)?*optr:buf;
+  char * const eptr = &buf[len];
+  size_t slen;
+  char *str;
+  int code;
+  uint64_t completed = 0;
+
+  bsize_t count = 0;
+  int     type  = AMBENCODE_LIST;
+  int     depth = base;
+
+  BGRAMMAR(WALK, base)
+
+ done:
+  if (optr) *optr = ptr;
+  if (values) *values = completed;
+  error->offset = ptr - buf;
+  error->code   = AMBENCODE_EOK;
+  return 0;
+
+ cancel:
+  error->offset = ptr - buf;
+  error->code   = AMBENCODE_EOK;
+  return ECANCELED;
+
+ fail:
+  error->offset = ptr - buf;
+  error->code   = code;
+  return EINVAL;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static int bobject_data(struct bhandle * const bhandle, size_t len,
+			poff_t * const offset) {
+
+  /* Allocate enough bobjects to hold len bytes of string or number data
+   * copied into the pool
+   */
+  struct bobject *bobject;
+
+  if (len == 0) {
+    *offset = 0;
+    return DECODE_OK;
+  }
+
+  bobject = bobject_allocate(bhandle, (poff_t)((len + (sizeof(struct bobject)-1)) /
+					       sizeof(struct bobject)));
+  if (AM_UNLIKELY(!bobject)) return DECODE_ENOMEM;
+
+  *offset = BOBJECT_OFFSET(bhandle, bobject);
+  return DECODE_OK;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+struct bobject *bobject_allocate(struct bhandle * const bhandle, poff_t count) {
+
+  poff_t used = bhandle->used + count;
+
+  if (AM_UNLIKELY(used <= bhandle->used)) goto error; /* overflow */  
+  if (AM_LIKELY(used < bhandle->count)) {
+
+    struct bobject *bobject = &bhandle->bobject[bhandle->used];
+    bhandle->used = used;
+    
+    return bobject;
+  }
+
+  if (!bhandle->userbuffer) {
+    
+    poff_t ncount = (bhandle->count * 2) + count;
+    
+    if (AM_UNLIKELY(ncount <= bhandle->count)) goto error; /* overflow */
+        
+    if (bobject_resize(bhandle, ncount)) {
+      return bobject_allocate(bhandle, count);
+    }
+  }
+
+ error:
+  return (struct bobject *)0;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static void *bobject_resize(struct bhandle * const bhandle, poff_t ncount) {
+
+  /* Resize a managed pool to ncount bobjects, it may move. Return the
+   * new pool or 0 leaving the pool unchanged if it could not be resized.
+   */
+  void *ptr;
+  size_t size = (size_t)ncount * sizeof(struct bobject);
+
+  /* The integer and symbol tables, like the data and link arrays, are
+   * grown before and shrunk after the pool so that they are never 
+   * smaller than it
+   */
+  if ((ncount > bhandle->count) && 
+      (bobject_tables(bhandle, ncount) != 0)) return (void *)0;
+
+#ifdef AM_MREMAP
+  if (bhandle->mapped) {
+
+    ptr = mremap(bhandle->bobject, 
+		 (size_t)bhandle->count * sizeof(struct bobject), size,
+		 MREMAP_MAYMOVE);
+    if (ptr == MAP_FAILED) return (void *)0;
+
+#ifdef MADV_HUGEPAGE
+    if (bhandle->hugepages) madvise(ptr, size, MADV_HUGEPAGE);
+#endif
+    goto done;
+  }
+#endif
+
+#ifdef AMBENCODE_SOA
+  /* The data and link arrays are grown before and shrunk after the pool
+   * so that they are never smaller than it
+   */
+  if ((ncount > bhandle->count) && 
+      (bobject_arrays(bhandle, ncount) != 0)) return (void *)0;
+#endif
+
+  ptr = realloc(bhandle->bobject, size);
+  if (!ptr) return (void *)0;
+
+#ifdef AMBENCODE_SOA
+  if (ncount < bhandle->count) bobject_arrays(bhandle, ncount);
+#endif
+
+#ifdef AM_MREMAP
+ done:
+#endif
+  if (ncount < bhandle->count) bobject_tables(bhandle, ncount);
+
+  bhandle->count   = ncount;
+  bhandle->bobject = (struct bobject *)ptr;
+  return ptr;
+}
+
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static int bobject_tables(struct bhandle * const bhandle, poff_t ncount) {
+
+  /* Resize the integer, symbol and span tables that are kept to ncount
+   * entries, on failure any may already have been resized.
+   */
+  void *ptr;
+
+  if (bhandle->integer) {
+    ptr = realloc(bhandle->integer, (size_t)ncount * sizeof(int64_t));
+    if (!ptr) return -1;
+    bhandle->integer = (int64_t *)ptr;
+  }
+
+  if (bhandle->symbol) {
+    ptr = realloc(bhandle->symbol, (size_t)ncount * sizeof(bsize_t));
+    if (!ptr) return -1;
+    bhandle->symbol = (bsize_t *)ptr;
+  }
+
+  if (bhandle->span) {
+    ptr = realloc(bhandle->span, (size_t)ncount * sizeof(struct bspan));
+    if (!ptr) return -1;
+    bhandle->span = (struct bspan *)ptr;
+  }
+
+  return 0;
+}
+
+
+#ifdef AMBENCODE_SOA
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static int bobject_arrays(struct bhandle * const bhandle, poff_t ncount) {
+
+  /* Resize the data and link arrays to ncount entries, on failure 
+   * either may already have been resized.
+   */
+  void *ptr;
+
+  ptr = realloc(bhandle->data, (size_t)ncount * sizeof(union bdata));
+  if (!ptr) return -1;
+  bhandle->data = (union bdata *)ptr;
+
+  ptr = realloc(bhandle->link, (size_t)ncount * sizeof(poff_t));
+  if (!ptr) return -1;
+  bhandle->link = (poff_t *)ptr;
+
+  return 0;
+}
+#endif
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+void bfind_free(struct bhandle * const bhandle) {
+
+  struct bfind *find;
+
+  while ((find = bhandle->find)) {
+    bhandle->find = find->next;
+    free(find);
+  }
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static int bobject_reserve(struct bhandle * const bhandle, size_t count) {
+
+  /* Ensure count bobjects can be allocated from the pool with a single
+   * reallocation of a managed pool
+   */
+  poff_t ncount;
+
+  if (AM_LIKELY(count < (size_t)(bhandle->count - bhandle->used))) {
+    return DECODE_OK;
+  }
+
+  if (bhandle->userbuffer) goto error;
+  if (count >= (size_t)(POFF_MAX - bhandle->used)) goto error; /* overflow */
+
+  ncount = bhandle->used + count + 1;
+  
+  if (bobject_resize(bhandle, ncount)) return DECODE_OK;
+
+ error:
+  return DECODE_ENOMEM;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static void bobject_expect(struct bhandle * const bhandle, xbsize_t len) {
+
+  /* Once a density has been learnt grow a managed pool that is too small
+   * for len bytes with a single reallocation rather than doubling it
+   * while decoding. Failure here is left for the decoder to report.
+   */
+  uint64_t expect;
 
-      if (AM_UNLIKELY(eptr == ptr)) goto fail;  
-      if (*ptr == 'e') {
-	ptr++;
-	goto success;
-      }
+  if ((bhandle->userbuffer) || (bhandle->density == 0)) return;
 
-    } else if ((unsigned char)(*ptr - '1') < 9) {
-      if (!str) str = ptr;
+  expect  = ((uint64_t)len * bhandle->density) / DENSITY_BYTES;
+  expect += (expect / 8) + BOBJECT_P;
+
+  if (expect >= POFF_MAX) return;
+  if (expect < (uint64_t)(bhandle->count - bhandle->used)) return;
+
+  bobject_reserve(bhandle, (size_t)expect);
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static void bobject_learn(struct bhandle * const bhandle, xbsize_t len) {
+
+  /* Fold the density of the document just decoded into a moving average 
+   * weighted 1/8 towards recent documents, rounded up so that the
+   * estimate errs on the side of a larger pool.
+   */
+  uint64_t density;
+
+  if (len == 0) return;
+
+  density = ((uint64_t)bhandle->used * DENSITY_BYTES + len - 1) / len;
+  if (density > DENSITY_BYTES) density = DENSITY_BYTES;
+
+  if (bhandle->density == 0) {
+    bhandle->density = (unsigned int)density;
+  } else {
+    bhandle->density = (unsigned int)
+      (((uint64_t)bhandle->density * 7 + density + 7) / 8);
+  }
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+
+/* BGRAMMAR hooks of ambencode_document(), a container is pushed onto
+ * the stack and it's bobject allocated once all of it's children have
+ * been decoded. A value just decoded is the last bobject allocated.
+ */
+#define DOCUMENT_FAIL(c)      goto fail
+#define DOCUMENT_DOCUMENT
+#define DOCUMENT_KEY          DOCUMENT_STRING
+#define DOCUMENT_STRING       if (AM_UNLIKELY((rc = ambencode_string(bhandle, &ptr)) != DECODE_OK)) goto fail;
+#define DOCUMENT_NUMBER       if (AM_UNLIKELY((rc = ambencode_number(bhandle, &ptr)) != DECODE_OK)) goto fail;
+#define DOCUMENT_OPEN
+#define DOCUMENT_SAVE(frame)  frame->first = first; frame->last = last;
+#define DOCUMENT_RESET        first = AMBENCODE_INVALID; last = AMBENCODE_INVALID;
+#define DOCUMENT_RESTORE(frame) first = frame->first; last = frame->last;
+#define DOCUMENT_COMPLETE
+#define DOCUMENT_TOP          bobject_document(bhandle, bhandle->used - 1);
+#define DOCUMENT_CHILD                                                        \
+  if (count == 0) {                                                           \
+    first = bhandle->used - 1;                                                \
+  } else {                                                                    \
+    BOBJECT_LINK(bhandle, BOBJECT_AT(bhandle, last)) = bhandle->used - 1;     \
+  }                                                                           \
+  last = bhandle->used - 1;
+#define DOCUMENT_MEMBER
+#define DOCUMENT_CONTAINER                                                    \
+  bobject = bobject_allocate(bhandle, 1);                                     \
+  if (AM_UNLIKELY(!bobject)) {                                                \
+    rc = DECODE_ENOMEM;                                                       \
+    goto fail;                                                                \
+  }                                                                           \
+  bobject->blen                               = count | (type << AMBENCODE_LENBITS); \
+  BOBJECT_LINK(bhandle, bobject)              = AMBENCODE_INVALID;            \
+  BOBJECT_DATA(bhandle, bobject).object.child = first;                        \
+  if ((type == AMBENCODE_DICTIONARY) && (bhandle->symbol) &&                  \
+      (AM_UNLIKELY((rc = bobject_intern(bhandle, first, count)) != DECODE_OK))) goto fail;
+#define DOCUMENT_CLOSE                                                        \
+  DOCUMENT_CONTAINER                                                          \
+  if (bhandle->span) bobject_span(bhandle, bobject, ptr);
+#define DOCUMENT_SETTLED
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static int ambencode_document(struct bhandle * const bhandle, char **optr) {
+
+  char *ptr = *optr;
+  char * const eptr = bhandle->eptr;
+  struct bframe * const stack = (bhandle->stack)?bhandle->stack:bhandle->frames;
+  const int max_depth = bhandle->max_depth;
+  struct bobject *bobject;
+  int rc = DECODE_EINVAL;
+
+  /* The innermost open container is held in locals, outer containers
+   * are saved on the container stack.
+   */
+  poff_t  first = AMBENCODE_INVALID;
+  poff_t  last  = AMBENCODE_INVALID;
+  bsize_t count = 0;
+  int     type  = AMBENCODE_LIST;
+  int     depth = 0;
+
+  BGRAMMAR(DOCUMENT, 0)
+
+ done:
+  bhandle->depth = depth;
+  *optr = ptr;
+  return DECODE_OK;
+
+ fail:
+  bhandle->depth = depth;
+  if (rc == DECODE_OK) rc = DECODE_EINVAL;
+  return rc;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+
+/* BGRAMMAR hooks of ambencode_tape(), the offset of a value just
+ * decoded is kept in value. The first child of a container needs no
+ * link, it always follows the container.
+ */
+#define TAPE_FAIL(c)          goto fail
+#define TAPE_DOCUMENT
+#define TAPE_KEY              TAPE_STRING
+#define TAPE_STRING           DOCUMENT_STRING value = bhandle->used - 1;
+#define TAPE_NUMBER           DOCUMENT_NUMBER value = bhandle->used - 1;
+#define TAPE_OPEN                                                             \
+  if (AM_UNLIKELY(!bobject_allocate(bhandle, 1))) {                           \
+    rc = DECODE_ENOMEM;                                                       \
+    goto fail;                                                                \
+  }
+#define TAPE_SAVE(frame)      frame->first = open; frame->last = last;
+#define TAPE_RESET            open = bhandle->used - 1; last = AMBENCODE_INVALID;
+#define TAPE_RESTORE(frame)   open = frame->first; last = frame->last;
+#define TAPE_COMPLETE
+#define TAPE_TOP              bobject_document(bhandle, value);
+#define TAPE_CHILD                                                            \
+  if (count) BOBJECT_LINK(bhandle, BOBJECT_AT(bhandle, last)) = value;        \
+  last = value;
+#define TAPE_MEMBER
+#define TAPE_CLOSE                                                            \
+  bobject = BOBJECT_AT(bhandle, open);                                        \
+  bobject->blen = count | (type << AMBENCODE_LENBITS);                        \
+  BOBJECT_LINK(bhandle, bobject) = AMBENCODE_INVALID;                         \
+  if ((type == AMBENCODE_DICTIONARY) && (bhandle->symbol) &&                  \
+      (AM_UNLIKELY((rc = bobject_intern(bhandle, open + 1, count)) != DECODE_OK))) goto fail; \
+  if (bhandle->span) bobject_span(bhandle, bobject, ptr);                     \
+  if ((type == AMBENCODE_LIST) && (LIST_INDEXED(bhandle, bobject))) {         \
+    if (AM_UNLIKELY((rc = ambencode_table(bhandle, open)) != DECODE_OK)) goto fail; \
+  }                                                                           \
+  BOBJECT_DATA(bhandle, BOBJECT_AT(bhandle, open)).object.child = bhandle->used; \
+  value = open;
+#define TAPE_SETTLED
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static int ambencode_tape(struct bhandle * const bhandle, char **optr) {
+
+  /* BGRAMMAR as ambencode_document() expands it but emitting bobjects
+   * in preorder. A container's bobject is allocated when it is opened
+   * and completed when it is closed, by which time all of it's 
+   * descendants follow it, it's table if any is the last part of it's
+   * subtree.
+   */
+  char *ptr = *optr;
+  char * const eptr = bhandle->eptr;
+  struct bframe * const stack = (bhandle->stack)?bhandle->stack:bhandle->frames;
+  const int max_depth = bhandle->max_depth;
+  struct bobject *bobject;
+  int rc = DECODE_EINVAL;
+
+  /* The innermost open container is held in locals, outer containers
+   * are saved on the container stack with the container's offset kept
+   * in first.
+   */
+  poff_t  open  = AMBENCODE_INVALID;
+  poff_t  last  = AMBENCODE_INVALID;
+  poff_t  value = AMBENCODE_INVALID;
+  bsize_t count = 0;
+  int     type  = AMBENCODE_LIST;
+  int     depth = 0;
+
+  BGRAMMAR(TAPE, 0)
+
+ done:
+  bhandle->depth = depth;
+  *optr = ptr;
+  return DECODE_OK;
+
+ fail:
+  bhandle->depth = depth;
+  if (rc == DECODE_OK) rc = DECODE_EINVAL;
+  return rc;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static int ambencode_table(struct bhandle * const bhandle, poff_t list) {
+
+  /* Append the offset of every value of a completed tape list
+   */
+  bsize_t count = LIST_COUNT(BOBJECT_AT(bhandle, list));
+  size_t size = TAPE_TABLE_SIZE(count);
+  poff_t next = list + 1;
+  char *table;
+  bsize_t i;
+
+  if (AM_UNLIKELY(size > POFF_MAX)) return DECODE_ENOMEM;
+
+  table = (char *)bobject_allocate(bhandle, (poff_t)size);
+  if (AM_UNLIKELY(!table)) return DECODE_ENOMEM;
+
+  for (i=0; i<count; i++) {
+    memcpy(&table[i * sizeof(poff_t)], &next, sizeof(poff_t));
+    next = BOBJECT_LINK(bhandle, BOBJECT_AT(bhandle, next));
+  }
+
+  return DECODE_OK;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+
+/* BGRAMMAR hooks of ambencode_select(), those of ambencode_document()
+ * with the selection state of each container saved alongside it. The
+ * member of a container with a state > 0 is passed to the callback
+ * before it is decoded, a value after a key has the state already
+ * selected for it. A value that is skipped is walked by 
+ * ambencode_walk() in it's single value mode.
+ */
+#define SELECT_FAIL(c)        goto fail
+#define SELECT_SKIP                                                           \
+  if (ambencode_walk(stack, max_depth, depth, bhandle->buf, bhandle->len,     \
+		     &ptr, &skip, (void *)0, &error, (uint64_t *)0)) goto fail;
+#define SELECT_DOCUMENT                                                       \
+  selected = select->member(ctx, AMBENCODE_SELECT_ALL, (char *)0, 0, documents++); \
+  if (selected == AMBENCODE_SELECT_SKIP) {                                    \
+    SELECT_SKIP                                                               \
+    goto settled;                                                             \
+  }
+#define SELECT_KEY                                                            \
+  selected = AMBENCODE_SELECT_ALL;                                            \
+  if (state != AMBENCODE_SELECT_ALL) {                                        \
+    str = ambencode_scan_string(ptr, eptr, &slen);                            \
+    if (AM_UNLIKELY(!str)) goto fail;                                         \
+    selected = select->member(ctx, state, str, (bsize_t)slen, count / 2);     \
+    if (selected == AMBENCODE_SELECT_SKIP) {                                  \
+      ptr = str + slen;                                                       \
+      if (AM_UNLIKELY(eptr == ptr)) goto fail;                                \
+      SELECT_SKIP                                                             \
+      goto next;                                                              \
+    }                                                                         \
+  }                                                                           \
+  DOCUMENT_STRING
+#define SELECT_STRING         DOCUMENT_STRING
+#define SELECT_NUMBER         DOCUMENT_NUMBER
+#define SELECT_OPEN
+#define SELECT_SAVE(frame)    DOCUMENT_SAVE(frame) frame->state = state;
+#define SELECT_RESET          DOCUMENT_RESET state = selected;
+#define SELECT_RESTORE(frame) DOCUMENT_RESTORE(frame) state = frame->state;
+#define SELECT_COMPLETE
+#define SELECT_TOP            DOCUMENT_TOP
+#define SELECT_CHILD          DOCUMENT_CHILD
+#define SELECT_MEMBER                                                         \
+  selected = AMBENCODE_SELECT_ALL;                                            \
+  if ((state != AMBENCODE_SELECT_ALL) && (BCLASS(*ptr) != BCLASS_END)) {      \
+    selected = select->member(ctx, state, (char *)0, 0, count);               \
+    if (selected == AMBENCODE_SELECT_SKIP) {                                  \
+      str = ptr;                                                              \
+      SELECT_SKIP                                                             \
+      if ((rc = ambencode_placeholder(bhandle, str)) != DECODE_OK) goto fail; \
+      goto complete;                                                          \
+    }                                                                         \
+  }
+#define SELECT_CLOSE                                                          \
+  DOCUMENT_CONTAINER                                                          \
+  if (bhandle->span) {                                                        \
+    BOBJECT_SPAN(bhandle, bobject)->len = 0;                                  \
+    bobject_parent(bhandle, bobject);                                         \
+  }
+#define SELECT_SETTLED
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static int ambencode_select(struct bhandle * const bhandle, char **optr,
+			    const struct bselect * const select, void *ctx) {
+
+  /* BGRAMMAR as ambencode_document() expands it, each container also
+   * has a selection state. Members of a container with a state > 0 are
+   * passed to the callback before they are decoded, those of a container
+   * with state AMBENCODE_SELECT_ALL are all decoded. Members that were
+   * skipped have no bobjects to find the start of a container from, so
+   * it's span is left empty.
+   */
+  static const struct bevents skip = { 0, 0, 0, 0, 0, 0 };
+  char *ptr = *optr;
+  char * const eptr = bhandle->eptr;
+  struct bframe * const stack = (bhandle->stack)?bhandle->stack:bhandle->frames;
+  const int max_depth = bhandle->max_depth;
+  struct bobject *bobject;
+  struct berror error;
+  int rc = DECODE_EINVAL;
+  bsize_t documents = 0;
+  int selected;
+  size_t slen;
+  char *str;
+
+  poff_t  first = AMBENCODE_INVALID;
+  poff_t  last  = AMBENCODE_INVALID;
+  bsize_t count = 0;
+  int     type  = AMBENCODE_LIST;
+  int     state = AMBENCODE_SELECT_ALL;
+  int     depth = 0;
+
+  BGRAMMAR(SELECT, 0)
+
+ done:
+  bhandle->depth = depth;
+  *optr = ptr;
+  return DECODE_OK;
+
+ fail:
+  bhandle->depth = depth;
+  if (rc == DECODE_OK) rc = DECODE_EINVAL;
+  return rc;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static char *ambencode_pass(char *ptr) {
+
+  /* Return a pointer past a value that has already been validated, 
+   * nothing is checked
+   */
+  bsize_t len;
+  int depth = 0;
+
+  do {
+    switch (*ptr) {
+    case 'd':
+    case 'l':
+      depth++;
       ptr++;
-    
-    nextdigit:
-    
-      if (AM_UNLIKELY(eptr == ptr)) goto fail;  
-      if ((unsigned char)(*ptr - '0') < 10) {
-	ptr++;
-      
-	goto nextdigit;
-      }
-
-      if (AM_UNLIKELY(eptr == ptr)) goto fail;  
-      if (*ptr == 'e') {
-	ptr++;
-	goto success;
-      }
+      break;
+    case 'e':
+      depth--;
+      ptr++;
+      break;
+    case 'i':
+      while (*ptr++ != 'e');
+      break;
+    default:
+      len = 0;
+      while (*ptr != ':') len = (len * 10) + (bsize_t)(*ptr++ - '0');
+      ptr += len + 1;
+      break;
     }
+  } while (depth);
+
+  return ptr;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static int ambencode_placeholder(struct bhandle * const bhandle, char *ptr) {
+
+  /* An empty string standing in for a list value that was skipped
+   */
+  struct bobject *bobject = bobject_allocate(bhandle, 1);
+
+  if (AM_UNLIKELY(!bobject)) return DECODE_ENOMEM;
+
+  bobject->blen                                = 0 | (AMBENCODE_STRING << AMBENCODE_LENBITS);
+  BOBJECT_LINK(bhandle, bobject)               = AMBENCODE_INVALID;
+  BOBJECT_DATA(bhandle, bobject).string.offset = ptr - bhandle->buf;
+
+  return DECODE_OK;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static size_t ambencode_digits(const char *ptr, const char * const eptr) {
+
+  /* Return the number of ASCII digits from ptr up to eptr
+   */
+  const char * const sptr = ptr;
+
+#ifdef AM_SSE4
+  while (eptr - ptr >= 16) {
+
+    const __m128i v = _mm_sub_epi8(_mm_loadu_si128((const __m128i *)ptr),
+				   _mm_set1_epi8('0'));
+    const unsigned int mask = ~(unsigned int)_mm_movemask_epi8(
+      _mm_cmpeq_epi8(_mm_min_epu8(v, _mm_set1_epi8(9)), v)) & 0xffff;
+
+    if (mask) return (ptr - sptr) + __builtin_ctz(mask);
+    ptr += 16;
+  }
+#endif
+
+#ifdef AM_SWAR
+  while (eptr - ptr >= 8) {
+
+    uint64_t v;
+    uint64_t mask;
+
+    /* A byte is a digit when both it's high nibble and the high nibble 
+     * of the byte plus 6 are 3. Carries only propagate towards later 
+     * bytes so the first non digit is always found.
+     */
+    memcpy(&v, ptr, 8);
+    mask = ((v & UINT64_C(0xF0F0F0F0F0F0F0F0)) ^ UINT64_C(0x3030303030303030)) |
+      (((v + UINT64_C(0x0606060606060606)) & UINT64_C(0xF0F0F0F0F0F0F0F0)) ^
+       UINT64_C(0x3030303030303030));
+
+    if (mask) return (ptr - sptr) + (__builtin_ctzll(mask) >> 3);
+    ptr += 8;
+  }
+#endif
+
+  while ((ptr != eptr) && ((unsigned char)(*ptr - '0') < 10)) {
+    ptr++;
+  }
+
+  return ptr - sptr;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+#ifdef AM_SWAR
+static uint64_t ambencode_swar8(const char *ptr, size_t len) {
+
+  /* Return the value of 1 to 8 ASCII digits, 8 bytes must be readable.
+   * The digits are shifted to the most significant end so the unused 
+   * bytes become leading zeros, then pairs, quads and octets of digits
+   * are combined with a multiply each.
+   */
+  uint64_t v;
+
+  memcpy(&v, ptr, 8);
+  v <<= (8 - len) * 8;
+
+  v = ((v & UINT64_C(0x0F0F0F0F0F0F0F0F)) * 2561) >> 8;
+  v = ((v & UINT64_C(0x00FF00FF00FF00FF)) * 6553601) >> 16;
+  return ((v & UINT64_C(0x0000FFFF0000FFFF)) * UINT64_C(42949672960001)) >> 32;
+}
+#endif
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static AM_INLINE uint64_t ambencode_atou(const char *ptr, size_t len,
+					 const char * const eptr __attribute__((unused))) {
+
+  /* Return the value of len ASCII digits, len is at most 16.
+   */
+  uint64_t value;
+
+#ifdef AM_SSE4
+  if (eptr - ptr >= 16) {
+
+    /* Right align the digits, shuffle indices for the leading bytes are
+     * negative which zeroes them. Then combine pairs, quads and octets.
+     */
+    __m128i v = _mm_sub_epi8(_mm_loadu_si128((const __m128i *)ptr),
+			     _mm_set1_epi8('0'));
+
+    v = _mm_shuffle_epi8(v, _mm_add_epi8(_mm_setr_epi8(0, 1, 2, 3, 4, 5, 6, 7, 
+						       8, 9, 10, 11, 12, 13, 14, 15),
+					 _mm_set1_epi8((char)(len - 16))));
+    v = _mm_maddubs_epi16(v, _mm_setr_epi8(10, 1, 10, 1, 10, 1, 10, 1,
+					   10, 1, 10, 1, 10, 1, 10, 1));
+    v = _mm_madd_epi16(v, _mm_setr_epi16(100, 1, 100, 1, 100, 1, 100, 1));
+    v = _mm_packus_epi32(v, v);
+    v = _mm_madd_epi16(v, _mm_setr_epi16(10000, 1, 10000, 1, 10000, 1, 10000, 1));
+
+    return ((uint64_t)(uint32_t)_mm_cvtsi128_si32(v) * 100000000) +
+      (uint32_t)_mm_extract_epi32(v, 1);
+  }
+#endif
+
+#ifdef AM_SWAR
+  if (eptr - ptr >= 8) {
+    if (len <= 8) return ambencode_swar8(ptr, len);
+
+    return (ambencode_swar8(ptr, len - 8) * 100000000) +
+      ambencode_swar8(ptr + len - 8, 8);
+  }
+#endif
+
+  value = 0;
+  while (len--) {
+    value *= 10;
+    value += (unsigned char)(*ptr++ - '0');
+  }
+
+  return value;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static AM_INLINE int64_t ambencode_i64(const char *ptr, size_t len,
+				       const char * const eptr) {
+
+  /* Convert an integer checked by ambencode_scan_number(), at most 19
+   * characters including any sign, so the magnitude fits a uint64_t.
+   * Return AMBENCODE_BIGINTEGER if it does not fit an int64_t.
+   */
+  uint64_t magnitude;
+  int negative = (*ptr == '-');
+
+  if (negative) {
+    ptr++;
+    len--;
+  }
+
+  if (len > 16) {
+    magnitude = (ambencode_atou(ptr, len - 16, eptr) * UINT64_C(10000000000000000)) +
+      ambencode_atou(ptr + len - 16, 16, eptr);
+  } else {
+    magnitude = ambencode_atou(ptr, len, eptr);
   }
 
-  goto fail;
+  if (AM_UNLIKELY(magnitude > (uint64_t)INT64_MAX)) return AMBENCODE_BIGINTEGER;
+
+  return (negative)?-(int64_t)magnitude:(int64_t)magnitude;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static AM_INLINE char *ambencode_scan_string(char *ptr, char * const eptr,
+					     size_t * const olen) {
+
+  /* On entry ptr is a digit, on success return a pointer to the string
+   * data and it's length in *olen otherwise (char *)0
+   */
+  size_t len;
+  uint64_t value;
+
+  /* Most length prefixes are one or two digits, these are converted a
+   * byte at a time since the position of the next value depends on the
+   * result and this has the shortest latency.
+   */
+  if (AM_LIKELY(eptr - ptr >= 3)) {
+
+    const int next = BCLASS(ptr[1]);
 
- success:
+    value = (unsigned char)(ptr[0] - '0');
+    if (next == BCLASS_COLON) {
+      ptr += 2;
+      goto length;
+    }
 
-  len = (ptr-1) - ((*optr)+1); 
-  if (len > 19) goto fail;
+    if ((value != 0) && (next <= BCLASS_DIGIT) && (next != BCLASS_INVALID) &&
+	(BCLASS(ptr[2]) == BCLASS_COLON)) {
+      value = (value * 10) + (unsigned char)(ptr[1] - '0');
+      ptr += 3;
+      goto length;
+    }
+  }
   
-  bobject = bobject_allocate(bhandle, 1);
+  /* The length prefix must be terminated by ':', may only have a leading
+   * zero when it is zero and must fit in AMBENCODE_MAXSTR.
+   */
+  len = ambencode_digits(ptr, eptr);
+  if (AM_UNLIKELY(len > 16)) goto fail;
+  if (AM_UNLIKELY((size_t)(eptr - ptr) == len)) goto fail;
+  if (AM_UNLIKELY(BCLASS(ptr[len]) != BCLASS_COLON)) goto fail;
+  if (AM_UNLIKELY((BCLASS(*ptr) == BCLASS_ZERO) && (len != 1))) goto fail;
 
-  bobject->blen            = len | (AMBENCODE_NUMBER << AMBENCODE_LENBITS);
-  bobject->next            = AMBENCODE_INVALID;
-  bobject->u.string.offset = (str) - bhandle->buf;
+  value = ambencode_atou(ptr, len, eptr);
+  if (AM_UNLIKELY(value > AMBENCODE_MAXSTR)) goto fail;
 
-  *optr = ptr;
-  return;  
+  ptr += len + 1;
+
+ length:
+  if (AM_UNLIKELY(value > (size_t)(eptr - ptr))) goto fail;
+
+  *olen = value;
+  return ptr;
+
+ fail:
+  return (char *)0;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static AM_INLINE char *ambencode_scan_number(char *ptr, char * const eptr,
+					     size_t * const olen) {
+
+  /* On entry ptr is 'i', on success return a pointer to the number
+   * and it's length in *olen otherwise (char *)0
+   */
+  char *str = ++ptr;
+  size_t len;
+
+  if (AM_UNLIKELY(eptr == ptr)) goto fail;  
+  if (BCLASS(*ptr) == BCLASS_MINUS) ptr++;
+
+  /* At least one digit terminated by 'e', a leading zero is only 
+   * allowed for zero and at most 19 characters including any sign.
+   */
+  len = ambencode_digits(ptr, eptr);
+  if (AM_UNLIKELY(len == 0)) goto fail;
+  if (AM_UNLIKELY((size_t)(eptr - ptr) == len)) goto fail;
+  if (AM_UNLIKELY(BCLASS(ptr[len]) != BCLASS_END)) goto fail;
+  if (AM_UNLIKELY((BCLASS(*ptr) == BCLASS_ZERO) && (len != 1))) goto fail;
+
+  len += ptr - str;
+  if (AM_UNLIKELY(len > 19)) goto fail;
+
+  *olen = len;
+  return str;
 
  fail:
-  longjmp(bhandle->setjmp_ctx, 2); /* jump back to ambencode_decode() with EINVAL */
+  return (char *)0;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static int ambencode_string_error(char **optr, char * const eptr) {
+
+  /* Called once ambencode_scan_string() has failed at *optr, return the
+   * class of error and move *optr to the byte at fault
+   */
+  char *ptr = *optr;
+  char *str = ptr;
+  size_t len;
+  uint64_t value;
+  int code;
+
+  len = ambencode_digits(ptr, eptr);
+
+  if ((BCLASS(*ptr) == BCLASS_ZERO) && (len != 1)) {
+    code = AMBENCODE_ELEADINGZERO;
+  } else if (len > 16) {
+    code = AMBENCODE_ELENGTH;
+    ptr += 16;
+  } else if ((size_t)(eptr - ptr) == len) {
+    code = AMBENCODE_ETRUNCATED;
+    ptr += len;
+  } else if (BCLASS(ptr[len]) != BCLASS_COLON) {
+    code = AMBENCODE_ELENGTH;
+    ptr += len;
+  } else {
+    value = ambencode_atou(ptr, len, eptr);
+    code  = (value > AMBENCODE_MAXSTR)?AMBENCODE_ELENGTH:AMBENCODE_ESTRING;
+    ptr   = str;
+  }
+
+  *optr = ptr;
+  return code;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static int ambencode_number_error(char **optr, char * const eptr) {
+
+  /* Called once ambencode_scan_number() has failed at *optr, return the
+   * class of error and move *optr to the byte at fault
+   */
+  char *ptr = *optr + 1;
+  char *str = ptr;
+  size_t len;
+  int code;
+
+  if (eptr == ptr) {
+    code = AMBENCODE_ETRUNCATED;
+    goto done;
+  }
+  if (BCLASS(*ptr) == BCLASS_MINUS) ptr++;
+
+  len = ambencode_digits(ptr, eptr);
+
+  if (len == 0) {
+    code = (eptr == ptr)?AMBENCODE_ETRUNCATED:AMBENCODE_EINTEGER;
+  } else if ((BCLASS(*ptr) == BCLASS_ZERO) && (len != 1)) {
+    code = AMBENCODE_ELEADINGZERO;
+  } else if (len + (ptr - str) > 19) {
+    code = AMBENCODE_EINTEGER;
+    ptr  = str + 19;
+  } else if ((size_t)(eptr - ptr) == len) {
+    code = AMBENCODE_ETRUNCATED;
+    ptr += len;
+  } else {
+    code = AMBENCODE_EINTEGER;
+    ptr += len;
+  }
+
+ done:
+  *optr = ptr;
+  return code;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static int ambencode_string(struct bhandle * const bhandle, char **optr) {
+
+  /* On entry *optr is a digit
+   */
+  struct bobject *bobject;
+  char *str;
+  size_t len;
+
+  str = ambencode_scan_string(*optr, bhandle->eptr, &len);
+  if (AM_UNLIKELY(!str)) return DECODE_EINVAL;
+
+  bobject = bobject_allocate(bhandle, 1);
+  if (AM_UNLIKELY(!bobject)) return DECODE_ENOMEM;
+
+  bobject->blen                                = len | (AMBENCODE_STRING << AMBENCODE_LENBITS);
+  BOBJECT_LINK(bhandle, bobject)               = AMBENCODE_INVALID;
+  BOBJECT_DATA(bhandle, bobject).string.offset = str - bhandle->buf;
+
+  *optr = str + len;
+  return DECODE_OK;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static int ambencode_number(struct bhandle * const bhandle, char **optr) {
+
+  /* On entry *optr is 'i'
+   */
+  struct bobject *bobject;
+  char *str;
+  size_t len;
+
+  str = ambencode_scan_number(*optr, bhandle->eptr, &len);
+  if (AM_UNLIKELY(!str)) return DECODE_EINVAL;
+
+  bobject = bobject_allocate(bhandle, 1);
+  if (AM_UNLIKELY(!bobject)) return DECODE_ENOMEM;
+
+  bobject->blen                                = len | (AMBENCODE_NUMBER << AMBENCODE_LENBITS);
+  BOBJECT_LINK(bhandle, bobject)               = AMBENCODE_INVALID;
+  BOBJECT_DATA(bhandle, bobject).string.offset = str - bhandle->buf;
+
+  if (bhandle->integer) {
+    BOBJECT_INT64(bhandle, bobject) = ambencode_i64(str, len, bhandle->eptr);
+  }
+
+  *optr = str + len + 1;
+  return DECODE_OK;
 }
 
 /* -------------------------------------------------------------------- */
@@ -42,18 +42,17 @@ THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 
 /* -------------------------------------------------------------------- */
 
-#include <setjmp.h>
 #include <sys/types.h>
 #include <stdint.h>
 
 /* -------------------------------------------------------------------- */
 
-#define AMBENCODE_MAXDEPTH 64     /* Set the maximum depth we will allow
-				   * lists and disctions to descend. Since we
-				   * use a recursive descent parser this is 
-				   * also affects the maximum stack depth used.
-				   * You may lower this number but it will affect 
-				   * the maximum nesting of your BENCODE objects */
+#define AMBENCODE_MAXDEPTH 64     /* Set the default maximum depth we will allow
+				   * lists and disctions to descend. A container
+				   * stack of this depth is held within each
+				   * bhandle, deeper nesting may be enabled at
+				   * runtime with ambencode_maxdepth() which 
+				   * allocates a larger container stack. */
 
 #define AMBENCODE_12              /* 32bit offsets ( see table** ) */
 /* #define AMBENCODE_6 */         /* 16bit offsets ( see table** ) */
@@ -66,8 +65,23 @@ THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 				   * now consume 16bytes instead of 12bytes on a 
 				   * 64 bit platform */
 
+/* #define AMBENCODE_SOA */       /* Hold the type:len, child or string 
+				   * offset and next of every bobject in 
+				   * three parallel arrays rather than one
+				   * packed array, walks that only need types
+				   * and links then touch fewer cache lines. 
+				   * The user supplied pool passed to 
+				   * ambencode_alloc() holds only type:len 
+				   * and pools are never mapped */
+
 /* #define USECOMPUTEDGOTO */     /* Use GCC extension for computed gotos */
 /* #define USEBRANCHHINTS */      /* Use hints to aid branch prediction */
+/* #define USESCALARDIGITS */     /* Scan length prefixes and integers a byte
+				   * at a time rather than with SSE4.1 or
+				   * SWAR instructions */
+/* #define USEMALLOCPOOL */       /* Allocate pools with malloc() when
+				   * ambencode_alloc_mapped() is called, 
+				   * rather than mapping them on Linux */
 
 
 /* -------------------------------------------------------------------- *
@@ -190,32 +204,172 @@ typedef uint8_t xboff_t;
 
 /* -------------------------------------------------------------------- */
 
+union bdata {
+
+  struct {
+    poff_t  child;                /* Index of first child */
+  } object;
+
+  struct {
+    xboff_t  offset;               /* First character Offset from start of 
+                                   * AMBENCODE buffer */ 
+  } string;
+};
+
+#define AMBENCODE_INVALID    0    /* Next offset use as value indicating 
+                                   * end of list */
+
+#ifdef AMBENCODE_SOA
+struct bobject {
+
+  bsize_t blen;                   /* type:len packed BENCODE_TYPEBITS 
+                                   * and AMBENCODE_LENBITS, the child or
+				   * string offset and next are held in
+				   * the bhandle's data and link arrays */
+};
+#else
 struct bobject {
 
+  bsize_t blen;                   /* type:len packed BENCODE_TYPEBITS 
+                                   * and AMBENCODE_LENBITS */
+  union bdata u;
+
+  poff_t next;                    /* next offset into bobject pool */
+
+} __attribute__((packed));
+#endif
+
 #define AMBENCODE_DICTIONARY 0
 #define AMBENCODE_LIST       1 
 #define AMBENCODE_STRING     2 
 #define AMBENCODE_NUMBER     3 
 
-  bsize_t blen;                   /* type:len packed BENCODE_TYPEBITS 
-                                   * and AMBENCODE_LENBITS */
-  union {
-    struct {
-      poff_t  child;              /* Index of first child */
-    } object;
+#define AMBENCODE_BIGINTEGER INT64_MIN /* A converted integer that does not
+					* fit an int64_t, INT64_MIN itself 
+					* is longer than BENCODE allows */
 
-    struct {
-      xboff_t  offset;             /* First character Offset from start of 
-                                   * AMBENCODE buffer */ 
-    } string;
-  } u;
+struct bframe {
 
-#define AMBENCODE_INVALID    0    /* Next offset use as value indicating 
-                                   * end of list */
+  poff_t         first;           /* Offset of first child */
+  poff_t         last;            /* Offset of last child */
+  bsize_t        count;           /* Children decoded so far */
+  int            type;            /* AMBENCODE_DICTIONARY or AMBENCODE_LIST */
+  int            state;           /* Selection state, see struct bselect */
+};
 
-  poff_t next;                    /* next offset into bobject pool */
+struct bfeed {
 
-} __attribute__((packed));
+  int            state;           /* Where ambencode_feed() resumes */
+  int            complete;        /* A value has been completed at depth 0 */
+  uint64_t       length;          /* Length prefix being converted */
+  uint64_t       remaining;       /* String data still to be copied */
+  poff_t         data;            /* Offset of string data in the pool */
+  int            digits;          /* Digits of length prefix or number */
+  char           number[20];      /* Number being accumulated */
+};
+
+struct bevents {
+
+  /* Callbacks made by ambencode_parse_events(), any may be 0. Returning
+   * !0 from a callback stops parsing */
+  int (*dictionary_start)(void *ctx);
+  int (*key)(void *ctx, char *ptr, bsize_t len);
+  int (*string)(void *ctx, char *ptr, bsize_t len);
+  int (*integer)(void *ctx, char *ptr, bsize_t len);
+  int (*list_start)(void *ctx);
+  int (*end)(void *ctx);
+};
+
+#define AMBENCODE_SELECT_SKIP -1 /* Validate a value without decoding it */
+#define AMBENCODE_SELECT_ALL   0  /* Decode all of a value */
+
+struct bselect {
+
+  /* Callback made by ambencode_decode_select() for each document, with
+   * a state of 0 and key of 0, and for each member of a container being
+   * selected from, with the state returned for the container and either
+   * it's key or index. Returns AMBENCODE_SELECT_SKIP, AMBENCODE_SELECT_ALL
+   * or a state > 0 to select from the members of a list or dictionary */
+  int (*member)(void *ctx, int state, char *key, bsize_t len, bsize_t index);
+};
+
+struct berror {
+
+#define AMBENCODE_EOK          0  /* No error */
+#define AMBENCODE_ETRUNCATED   1  /* Data ends before the value is complete */
+#define AMBENCODE_ESTRING      2  /* String data extends past the end */
+#define AMBENCODE_ELENGTH      3  /* Bad length prefix */
+#define AMBENCODE_ELEADINGZERO 4  /* Leading zero in length or integer */
+#define AMBENCODE_EINTEGER     5  /* Bad integer */
+#define AMBENCODE_EKEY         6  /* Dictionary key is not a string */
+#define AMBENCODE_EUNEXPECTED  7  /* Byte cannot start a value */
+#define AMBENCODE_EDEPTH       8  /* Maximum depth exceeded */
+#define AMBENCODE_ECOUNT       9  /* Too many values in list or dictionary */
+
+  xbsize_t       offset;          /* Offset of the byte at fault */
+  int            code;            /* Class of error */
+};
+
+struct bfind {
+
+  /* A hash or sorted index of the keys of one dictionary, built by 
+   * extras/ambencode_util.c and released with the bhandle */
+  struct bfind   *next;           /* Next indexed dictionary */
+  poff_t         dictionary;      /* Offset of the dictionary */
+  bsize_t        count;           /* It's count when indexed */
+  unsigned int   sorted:1;        /* slot[] holds the keys in order */
+  size_t         mask;            /* Slots - 1, slots are a power of 2, or
+				   * keys when sorted, 0 if they are not */
+  poff_t         slot[1];         /* Offset of a key + 1 or 0 if empty,
+				   * offset of a key when sorted */
+};
+
+struct bsymbol {
+
+  poff_t         key;             /* Offset of the first key given the 
+				   * symbol + 1, or 0 if the slot is empty */
+  bsize_t        symbol;          /* The symbol, from 1 */
+};
+
+struct bspan {
+
+  const char     *ptr;            /* The container's 'd' or 'l' in the
+				   * buffer decoded */
+  xbsize_t       len;             /* Bytes up to and including it's 'e', 0
+				   * if not known or no longer matching */
+  poff_t         parent;          /* Offset of the container holding it 
+				   * + 1, or 0, kept for every bobject */
+};
+
+struct blevel {
+
+  char           *open;           /* The 'd' or 'l' opening the container */
+  char           *key;            /* Key of the container in it's dictionary */
+  bsize_t        keylen;          /* Length of that key */
+  bsize_t        index;           /* Index of the current member */
+  int            type;            /* AMBENCODE_DICTIONARY or AMBENCODE_LIST */
+};
+
+struct bcursor {
+
+  /* A position within a BENCODE buffer, see ambencode_cursor_init() */
+  char           *buf;            /* The BENCODE buffer */
+  char           *eptr;           /* Pointer to character after the end of 
+                                   * the BENCODE buffer */
+  char           *ptr;            /* The current value or the 'e' ending 
+				   * it's container */
+  char           *vend;           /* End of the current value or 0 if it 
+				   * has not been found */
+  char           *key;            /* Key of the current value or 0 */
+  bsize_t        keylen;          /* Length of that key */
+  unsigned int   atend:1;         /* No current value, the container or
+				   * buffer has ended */
+  unsigned int   failed:1;        /* Invalid BENCODE has been found */
+  int            depth;           /* Containers entered */
+  struct blevel  level[AMBENCODE_MAXDEPTH];
+  struct bframe  frames[AMBENCODE_MAXDEPTH]; /* Containers within a value
+					      * being skipped */
+};
 
 struct bhandle {
 
@@ -223,51 +377,137 @@ struct bhandle {
   char           *eptr;           /* Pointer to character after the end of 
                                    * the BENCODE buffer */
   unsigned int   userbuffer:1;    /* Did user supply the buffer? */
-  unsigned int   useljmp:1;       /* We want to longjmp on allocation failure */
+  unsigned int   mapped:1;        /* Is the pool an anonymous mapping? */
+  unsigned int   hugepages:1;     /* Advise huge pages for a mapped pool */
+  unsigned int   tape:1;          /* Is the pool a preorder tape? */
+  unsigned int   tapeindex:1;     /* Do long tape lists have offset tables? */
+  unsigned int   findlazy:1;      /* Index large dictionaries on lookup */
+  unsigned int   findsorted:1;    /* Index them by sorting not hashing */
 
   xbsize_t       len;             /* Length of json data */  
-  jmp_buf        setjmp_ctx;      /* Allows us to return from allocation failure 
-				   * from deeply nested calls */
   
   struct bobject *bobject;        /* Preallocated bobject pool */
+#ifdef AMBENCODE_SOA
+  union bdata    *data;           /* Child or string offset of each bobject */
+  poff_t         *link;           /* Next offset of each bobject */
+#endif
   poff_t         count;           /* Size of bobject pool */
   poff_t         used;            /* Bobjects in use */
   poff_t         root;            /* Index of our root object */
+  poff_t         first;           /* Index of the first top level object,
+				   * when the buffer holds several they are 
+				   * linked by next and root is the last */
+  poff_t         documents;       /* Count of top level objects */
 
   int            depth;
   int            max_depth;       /* RFC 8259 section 9 allows us to set a 
                                    * max depth for list and object traversal */
+
+  struct bfeed   feed;            /* ambencode_feed() parser state */
+
+  unsigned int   density;         /* Bobjects per 1024 bytes learnt from 
+				   * previous decodes, 0 if none */
+  poff_t         peak;            /* Most bobjects used since the pool was
+				   * last checked for shrinking */
+  unsigned int   resets;          /* ambencode_reset() calls since the pool
+				   * was last checked for shrinking */
+
+  struct bfind   *find;           /* Dictionary key indexes, most recently
+				   * used first */
+
+  int64_t        *integer;        /* Integers converted while decoding 
+				   * indexed by bobject offset, or 0 */
+
+  bsize_t        *symbol;         /* Symbol of each dictionary key indexed
+				   * by bobject offset, or 0 */
+  struct bsymbol *symbols;        /* Keys interned, hashed */
+  size_t         symbolmask;      /* Slots - 1, slots are a power of 2 */
+  bsize_t        symbolcount;     /* Symbols given, the last symbol */
+
+  struct bspan   *span;           /* Source of each container indexed by
+				   * bobject offset, or 0 */
+
+  struct bframe  *stack;          /* Container stack when max_depth is greater
+				   * than AMBENCODE_MAXDEPTH, otherwise 0 and
+				   * frames is used */
+  struct bframe  frames[AMBENCODE_MAXDEPTH];
 };
 
 /* -------------------------------------------------------------------- */
 /* -------------------------------------------------------------------- */
 
 #define BOBJECT_LAST(bhandle)          (&(bhandle)->bobject[(bhandle)->used-1])
-#define BOBJECT_OFFSET(bhandle, o)     ((((char *)(o)) - ((char *)&(bhandle)->bobject[0]))) / sizeof(struct bobject)
+#define BOBJECT_OFFSET(bhandle, o)     (((((char *)(o)) - ((char *)&(bhandle)->bobject[0]))) / sizeof(struct bobject))
 #define BOBJECT_AT(bhandle, offset)    (&(bhandle)->bobject[(offset)])
 
+/* The child or string offset and next offset of a bobject, these may be
+ * assigned to
+ */
+#ifdef AMBENCODE_SOA
+#define BOBJECT_DATA(bhandle, o)       ((bhandle)->data[BOBJECT_OFFSET((bhandle), (o))])
+#define BOBJECT_LINK(bhandle, o)       ((bhandle)->link[BOBJECT_OFFSET((bhandle), (o))])
+#else
+#define BOBJECT_DATA(bhandle, o)       ((o)->u)
+#define BOBJECT_LINK(bhandle, o)       ((o)->next)
+#endif
+
 /* -------------------------------------------------------------------- */
 
 #define BOBJECT_ROOT(bhandle)          (BOBJECT_AT((bhandle), (bhandle)->root))
-#define BOBJECT_NEXT(bhandle,o)        ((((o)->next) == AMBENCODE_INVALID)?(struct bobject *)0:(BOBJECT_AT((bhandle), ((o)->next))))
+#define BOBJECT_FIRST(bhandle)         (((bhandle)->documents == 0)?(struct bobject *)0:(BOBJECT_AT((bhandle), (bhandle)->first)))
+#define BOBJECT_NEXT(bhandle,o)        (((BOBJECT_LINK((bhandle),(o))) == AMBENCODE_INVALID)?(struct bobject *)0:(BOBJECT_AT((bhandle), (BOBJECT_LINK((bhandle),(o))))))
 #define BOBJECT_TYPE(o)                ((o)->blen >> AMBENCODE_LENBITS)
 
+#define BOBJECT_CHILD(bhandle, o)      (((bhandle)->tape)?(poff_t)(BOBJECT_OFFSET((bhandle), (o)) + 1):BOBJECT_DATA((bhandle),(o)).object.child)
+
 #define BOBJECT_STRING_LEN(o)          ((o)->blen & AMBENCODE_STRLENMASK)
-#define BOBJECT_STRING_PTR(bhandle, o) (((o)->blen & AMBENCODE_STRBUFMASK)?((char *)(&(bhandle)->bobject[(o)->u.string.offset])):(&((bhandle)->buf[(o)->u.string.offset])))
+#define BOBJECT_STRING_PTR(bhandle, o) (((o)->blen & AMBENCODE_STRBUFMASK)?((char *)(&(bhandle)->bobject[BOBJECT_DATA((bhandle),(o)).string.offset])):(&((bhandle)->buf[BOBJECT_DATA((bhandle),(o)).string.offset])))
+
+/* The integer value of a number once ambencode_integers() has been called
+ * before decoding, AMBENCODE_BIGINTEGER if it does not fit an int64_t
+ */
+#define BOBJECT_INT64(bhandle, o)      ((bhandle)->integer[BOBJECT_OFFSET((bhandle), (o))])
+
+/* The symbol of a dictionary key once ambencode_intern() has been called 
+ * before decoding, keys are equal when their symbols are equal
+ */
+#define BOBJECT_SYMBOL(bhandle, o)     ((bhandle)->symbol[BOBJECT_OFFSET((bhandle), (o))])
+#define BOBJECT_SPAN(bhandle, o)       (&(bhandle)->span[BOBJECT_OFFSET((bhandle), (o))])
 
 #define LIST_COUNT(o)                 ((o)->blen & AMBENCODE_LENMASK)
-#define LIST_FIRST(bhandle, o)        ((((o)->blen & AMBENCODE_LENMASK) == 0)?(struct bobject *)0:(BOBJECT_AT((bhandle),(o)->u.object.child)))
-#define LIST_NEXT(bhandle, o)         ((((o)->next) == AMBENCODE_INVALID)?(struct bobject *)0:(BOBJECT_AT((bhandle), ((o)->next))))
+#define LIST_FIRST(bhandle, o)        ((((o)->blen & AMBENCODE_LENMASK) == 0)?(struct bobject *)0:(BOBJECT_AT((bhandle),BOBJECT_CHILD((bhandle),(o)))))
+#define LIST_NEXT(bhandle, o)         ((BOBJECT_LINK((bhandle),(o)) == AMBENCODE_INVALID)?(struct bobject *)0:(BOBJECT_AT((bhandle), BOBJECT_LINK((bhandle),(o)))))
 #define DICTIONARY_COUNT(o)                ((o)->blen & AMBENCODE_LENMASK)
-#define DICTIONARY_FIRST_KEY(bhandle, o)   ((((o)->blen & AMBENCODE_LENMASK) == 0)?(struct bobject *)0:(BOBJECT_AT((bhandle),(o)->u.object.child)))
-#define DICTIONARY_NEXT_KEY(bhandle, o)    ((((o)->next) == AMBENCODE_INVALID)?(struct bobject *)0:((BOBJECT_AT((bhandle), ((o)->next))->next == AMBENCODE_INVALID)?(struct bobject *)0:BOBJECT_AT((bhandle),BOBJECT_AT((bhandle), ((o)->next))->next)))
-#define DICTIONARY_FIRST_VALUE(bhandle, o) ((((o)->blen & AMBENCODE_LENMASK) == 0)?(struct bobject *)0:BOBJECT_AT((bhandle), BOBJECT_AT((bhandle), (o)->u.object.child)->next))
-#define DICTIONARY_NEXT_VALUE(bhandle, o)    ((((o)->next) == AMBENCODE_INVALID)?(struct bobject *)0:((BOBJECT_AT((bhandle), ((o)->next))->next == AMBENCODE_INVALID)?(struct bobject *)0:BOBJECT_AT((bhandle),BOBJECT_AT((bhandle), ((o)->next))->next)))
+#define DICTIONARY_FIRST_KEY(bhandle, o)   ((((o)->blen & AMBENCODE_LENMASK) == 0)?(struct bobject *)0:(BOBJECT_AT((bhandle),BOBJECT_CHILD((bhandle),(o)))))
+#define DICTIONARY_NEXT_KEY(bhandle, o)    ((BOBJECT_LINK((bhandle),(o)) == AMBENCODE_INVALID)?(struct bobject *)0:((BOBJECT_LINK((bhandle), BOBJECT_AT((bhandle), BOBJECT_LINK((bhandle),(o)))) == AMBENCODE_INVALID)?(struct bobject *)0:BOBJECT_AT((bhandle),BOBJECT_LINK((bhandle), BOBJECT_AT((bhandle), BOBJECT_LINK((bhandle),(o)))))))
+#define DICTIONARY_FIRST_VALUE(bhandle, o) ((((o)->blen & AMBENCODE_LENMASK) == 0)?(struct bobject *)0:BOBJECT_AT((bhandle), BOBJECT_LINK((bhandle), BOBJECT_AT((bhandle), BOBJECT_CHILD((bhandle),(o))))))
+#define DICTIONARY_NEXT_VALUE(bhandle, o)    ((BOBJECT_LINK((bhandle),(o)) == AMBENCODE_INVALID)?(struct bobject *)0:((BOBJECT_LINK((bhandle), BOBJECT_AT((bhandle), BOBJECT_LINK((bhandle),(o)))) == AMBENCODE_INVALID)?(struct bobject *)0:BOBJECT_AT((bhandle),BOBJECT_LINK((bhandle), BOBJECT_AT((bhandle), BOBJECT_LINK((bhandle),(o)))))))
 #define BOBJECT_STRDUP(o)              ((BOBJECT_TYPE((o)) != AMBENCODE_STRING)?((struct bobject *)0):strndup(BOBJECT_STRING_PTR((o)),BOBJECT_STRING_LEN((o))))
 
 #define BOBJECT_P                      6
 #define BOBJECT_COUNT_GUESS(size)      ((((size) / BOBJECT_P)<BOBJECT_P)?BOBJECT_P:((size) / BOBJECT_P))
 
+#define AMBENCODE_HUGEPAGES            1 /* ambencode_alloc_mapped() flags */
+
+/* A pool decoded by ambencode_decode_tape() is a preorder tape, every
+ * container is followed by it's children and then their descendants in
+ * the order they appear. The first child of a container is always the 
+ * next bobject so child instead holds the offset one past the end of 
+ * the container, a subtree is skipped by jumping there. next links 
+ * siblings as in any other pool.
+ *
+ * With AMBENCODE_TAPE_INDEX a list of AMBENCODE_TAPE_INDEXMIN or more
+ * values ends with a table of the offset of every value, LIST_TABLE(),
+ * which ambencode_array_index() uses to index the list in constant time.
+ */
+#define AMBENCODE_TAPE_INDEX           1 /* ambencode_decode_tape() flags */
+#define AMBENCODE_TAPE_INDEXMIN        8
+
+#define TAPE_SKIP(bhandle, o)          ((BOBJECT_TYPE((o)) >= AMBENCODE_STRING)?(poff_t)(BOBJECT_OFFSET((bhandle), (o)) + 1):BOBJECT_DATA((bhandle),(o)).object.child)
+#define TAPE_TABLE_SIZE(count)         ((((size_t)(count) * sizeof(poff_t)) + (sizeof(struct bobject)-1)) / sizeof(struct bobject))
+#define LIST_INDEXED(bhandle, o)       (((bhandle)->tapeindex) && (LIST_COUNT((o)) >= AMBENCODE_TAPE_INDEXMIN))
+#define LIST_TABLE(bhandle, o)         ((poff_t *)(void *)BOBJECT_AT((bhandle), BOBJECT_DATA((bhandle),(o)).object.child - TAPE_TABLE_SIZE(LIST_COUNT((o)))))
+
 /* -------------------------------------------------------------------- */
 
 #ifndef __cplusplus
@@ -296,6 +536,23 @@ extern "C" {
  */
 int ambencode_alloc(struct bhandle *bhandle, struct bobject *ptr, poff_t count);
 
+/* Summary: Create a new ambencode context whose bobject pool is an 
+ *          anonymous memory mapping. On Linux the pool is grown with
+ *          mremap() which moves pages rather than copying bobjects and
+ *          never holds two copies of the pool, elsewhere an ordinary
+ *          pool is allocated as by ambencode_alloc(). Best suited to 
+ *          large documents.
+ * bhandle: This is a pointer to an uninitialised bhandle structure.
+ *          On success the context will be initialised, a subsequent call
+ *          to ambencode_free() must be made to release any resources held.
+ * count:   This is the initial count of struct bobject in the pool.
+ * flags:   AMBENCODE_HUGEPAGES advises the kernel to back the pool with
+ *          transparent huge pages, reducing TLB misses on large pools.
+ *
+ * Return 0 on success and !0 on failure.
+ */
+int ambencode_alloc_mapped(struct bhandle *bhandle, poff_t count, int flags);
+
 /* Summary: Decode a buffer holding BENCODE data using the ambencode context 
  *          allocated by the call to ambencode_alloc()
  * bhandle: This is a pointer to an initialised bhandle structure.
@@ -311,6 +568,382 @@ int ambencode_alloc(struct bhandle *bhandle, struct bobject *ptr, poff_t count);
  */
 int ambencode_decode(struct bhandle *bhandle, char *buf, xbsize_t len);
 
+/* Summary: Decode a buffer holding BENCODE data into a preorder tape
+ *          rather than the post-order pool built by ambencode_decode().
+ *          Each container records the end of it's subtree, so subtrees
+ *          can be skipped, and long lists may be indexed in constant
+ *          time. The LIST_* and DICTIONARY_* macros, ambencode_query()
+ *          and ambencode_dump() work with either pool. A tape must not 
+ *          be changed with the functions of extras/ambencode_mod.c
+ * bhandle: This is a pointer to an initialised bhandle structure.
+ * buf:     This is a pointer to a buffer holding BENCODE data to be parsed.
+ *          The contents of this buffer MUST not be freed or changed while
+ *          the ambencode context exists.
+ * len:     This is the length of the BENCODE buffer in bytes.
+ * flags:   AMBENCODE_TAPE_INDEX adds a table of the offset of every
+ *          value to lists of at least AMBENCODE_TAPE_INDEXMIN values.
+ *
+ * Return 0 on success and !0 on failure.
+ * The value of errno will be set to EINVAL if an error ocurred parsing
+ * the BENCODE buffer. ENOMEM indicates a problem allocating an object from
+ * the bobject pool.
+ */
+int ambencode_decode_tape(struct bhandle *bhandle, char *buf, xbsize_t len,
+			  int flags);
+
+/* Summary: Decode only the parts of a buffer selected by a callback, 
+ *          using an ambencode context allocated by the call to 
+ *          ambencode_alloc(). Values that are not selected are validated
+ *          as they are skipped but no bobjects are allocated for them. 
+ *          Dictionaries hold only the members selected, list values that
+ *          are not selected are held as empty strings so the index of 
+ *          each value is kept.
+ * bhandle: This is a pointer to an initialised bhandle structure.
+ * buf:     This is a pointer to a buffer holding BENCODE data, this must
+ *          not be freed or modified while the ambencode context exists.
+ * len:     This is the length of the BENCODE buffer in bytes.
+ * select:  Callbacks choosing the values decoded, see struct bselect.
+ * ctx:     Passed to each callback.
+ *
+ * Return 0 on success and !0 on failure.
+ * The value of errno will be set to EINVAL if an error ocurred parsing
+ * the BENCODE buffer. ENOMEM indicates a problem allocating an object from
+ * the bobject pool. ENOENT indicates that every document was skipped, 
+ * there is then no BOBJECT_ROOT().
+ */
+int ambencode_decode_select(struct bhandle *bhandle, char *buf, xbsize_t len,
+			    const struct bselect *select, void *ctx);
+
+/* Summary: Decode BENCODE data delivered in chunks, such as reads from a
+ *          socket or pipe, using an ambencode context allocated by the 
+ *          call to ambencode_alloc()
+ *          Parser state is kept in the bhandle between calls and each
+ *          bobject is added to the pool as soon as it is complete. 
+ *          Strings and numbers are copied into the bobject pool so the
+ *          chunk is not referenced once the call returns. 
+ *          ambencode_decode() must not be used with the same context.
+ * bhandle: This is a pointer to an initialised bhandle structure.
+ * buf:     This is a pointer to the next chunk of BENCODE data, it may
+ *          end anywhere, including part way through a string.
+ * len:     This is the length of the chunk in bytes.
+ *
+ * Return 0 on success and !0 on failure.
+ * The value of errno will be set to EINVAL if an error ocurred parsing
+ * the BENCODE data. ENOMEM indicates a problem allocating an object from
+ * the bobject pool. Once a call has failed all further calls will fail.
+ */
+int ambencode_feed(struct bhandle *bhandle, char *buf, xbsize_t len);
+
+/* Summary: Signal the end of the data passed to ambencode_feed()
+ * bhandle: This is a pointer to an initialised bhandle structure.
+ *
+ * Return 0 if the data fed was complete and !0 otherwise, in which case
+ * errno will be set to EINVAL. On success root is the last value 
+ * completed outside of any list or dictionary.
+ */
+int ambencode_feed_end(struct bhandle *bhandle);
+
+/* Summary: Parse a buffer holding BENCODE data reporting each value to a
+ *          callback rather than building a DOM, no bobjects are allocated.
+ *          Keys, strings and integers are passed as pointers into the 
+ *          BENCODE buffer, integers are passed as their text including
+ *          any sign. end is called for the end of both dictionaries and 
+ *          lists. The same BENCODE data is accepted as ambencode_decode() 
+ * bhandle: This is a pointer to an initialised bhandle structure whose
+ *          maximum depth and container stack are used, the bobject pool
+ *          is not. If this is (struct bhandle *)0 AMBENCODE_MAXDEPTH is
+ *          used.
+ * buf:     This is a pointer to a buffer holding BENCODE data to be parsed.
+ * len:     This is the length of the BENCODE buffer in bytes.
+ * events:  This is a pointer to the callbacks to be made.
+ * ctx:     This is passed to every callback.
+ *
+ * Return 0 on success and !0 on failure.
+ * The value of errno will be set to EINVAL if an error ocurred parsing
+ * the BENCODE buffer and ECANCELED if a callback stopped parsing. 
+ * Callbacks may already have been made for data preceding an error.
+ */
+int ambencode_parse_events(struct bhandle *bhandle, char *buf, xbsize_t len,
+			   const struct bevents *events, void *ctx);
+
+/* Summary: Check that a buffer holds valid BENCODE data without building
+ *          a DOM. The same BENCODE data is accepted as ambencode_decode()
+ * bhandle: This is a pointer to an initialised bhandle structure whose
+ *          maximum depth and container stack are used, the bobject pool
+ *          is not. If this is (struct bhandle *)0 AMBENCODE_MAXDEPTH is
+ *          used.
+ * buf:     This is a pointer to a buffer holding BENCODE data.
+ * len:     This is the length of the BENCODE buffer in bytes.
+ * error:   On failure this is set to the offset of the byte at fault and
+ *          one of the AMBENCODE_E* error classes.
+ *
+ * Return 0 on success and !0 on failure.
+ * The value of errno will be set to EINVAL if the BENCODE data is invalid.
+ */
+int ambencode_validate(struct bhandle *bhandle, char *buf, xbsize_t len,
+		       struct berror *error);
+
+/* Summary: Describe an error class returned by ambencode_validate()
+ * error:   One of the AMBENCODE_E* error classes.
+ *
+ * Return a constant string.
+ */
+const char *ambencode_strerror(int error);
+
+/* Summary: Count the bobjects needed to decode a buffer holding BENCODE
+ *          data without building a DOM, so that a bobject pool can be
+ *          allocated once with ambencode_alloc() and never grown by
+ *          ambencode_decode(). Costs about as much as ambencode_validate()
+ *          and is worthwhile where BOBJECT_COUNT_GUESS() is far out, such
+ *          as .torrent files or dense lists of integers.
+ * bhandle: This is a pointer to an initialised bhandle structure whose
+ *          maximum depth and container stack are used, the bobject pool
+ *          is not. If this is (struct bhandle *)0 AMBENCODE_MAXDEPTH is
+ *          used.
+ * buf:     This is a pointer to a buffer holding BENCODE data.
+ * len:     This is the length of the BENCODE buffer in bytes.
+ * count:   On success this is set to the count to be passed to
+ *          ambencode_alloc(), one more than the number of bobjects as
+ *          the pool always keeps one free.
+ *
+ * Return 0 on success and !0 on failure.
+ * The value of errno will be set to EINVAL if the BENCODE data is invalid
+ * and ENOMEM if the count does not fit in a poff_t.
+ */
+int ambencode_count(struct bhandle *bhandle, char *buf, xbsize_t len,
+		    poff_t *count);
+
+/* Summary: Position a cursor on the first value of a buffer holding
+ *          BENCODE data. A cursor reads values in the order they appear
+ *          without building a DOM or allocating, values that are passed
+ *          over are skipped using their length prefixes and validated as
+ *          they are skipped. Every byte read is checked, values after 
+ *          the last one reached are not. Once invalid BENCODE is found
+ *          every call fails with EINVAL.
+ * cursor:  This is a pointer to a cursor structure.
+ * buf:     This is a pointer to a buffer holding BENCODE data.
+ * len:     This is the length of the BENCODE buffer in bytes.
+ *
+ * Return 0 on success and !0 on failure.
+ * The value of errno will be set to EINVAL if the buffer is empty.
+ */
+int ambencode_cursor_init(struct bcursor *cursor, char *buf, xbsize_t len);
+
+/* Summary: Move a cursor to the next value of the container it is in, or
+ *          the next document of the buffer at the top level. The value
+ *          being passed over is skipped if it was not read.
+ * cursor:  This is a pointer to an initialised cursor structure.
+ *
+ * Return 0 on success and !0 on failure.
+ * The value of errno will be set to ENOENT once the container or buffer
+ * has ended and EINVAL if the BENCODE data is invalid.
+ */
+int ambencode_cursor_next(struct bcursor *cursor);
+
+/* Summary: Return the type of the current value, this is
+ *          AMBENCODE_STRING, AMBENCODE_NUMBER, AMBENCODE_LIST or 
+ *          AMBENCODE_DICTIONARY. The key of a dictionary member is in 
+ *          cursor->key and cursor->keylen.
+ * cursor:  This is a pointer to an initialised cursor structure.
+ *
+ * Return the type on success and -1 on failure.
+ * The value of errno will be set to ENOENT if there is no current value
+ * and EINVAL if the BENCODE data is invalid.
+ */
+int ambencode_cursor_type(struct bcursor *cursor);
+
+/* Summary: Move a cursor into the current value, a list or dictionary,
+ *          to it's first member.
+ * cursor:  This is a pointer to an initialised cursor structure.
+ *
+ * Return 0 on success and !0 on failure.
+ * The value of errno will be set to ENOENT if the container is empty,
+ * the cursor is still moved into it. EINVAL if the current value is not
+ * a container, AMBENCODE_MAXDEPTH would be exceeded or the BENCODE data
+ * is invalid.
+ */
+int ambencode_cursor_enter(struct bcursor *cursor);
+
+/* Summary: Move a cursor out of the container it is in, the container 
+ *          becomes the current value. Any members not yet passed over 
+ *          are skipped.
+ * cursor:  This is a pointer to an initialised cursor structure.
+ *
+ * Return 0 on success and !0 on failure.
+ * The value of errno will be set to EINVAL if the cursor is at the top
+ * level or the BENCODE data is invalid.
+ */
+int ambencode_cursor_leave(struct bcursor *cursor);
+
+/* Summary: Move a cursor to a member of the dictionary it is in. Members
+ *          from the current one to the end are searched first, then those
+ *          before it, so that keys wanted in the order they are stored 
+ *          are each found by moving forward.
+ * cursor:  This is a pointer to an initialised cursor structure.
+ * key:     This is a pointer to the key.
+ * len:     This is the length of the key in bytes.
+ *
+ * Return 0 on success and !0 on failure.
+ * The value of errno will be set to ENOENT if the key is not found, the
+ * cursor is then where it was. EINVAL if the cursor is not in a 
+ * dictionary or the BENCODE data is invalid.
+ */
+int ambencode_cursor_find_key(struct bcursor *cursor, const char *key,
+			      bsize_t len);
+
+/* Summary: Read the current value as an integer.
+ * cursor:  This is a pointer to an initialised cursor structure.
+ * value:   On success this is set to the integer.
+ *
+ * Return 0 on success and !0 on failure.
+ * The value of errno will be set to ENOENT if there is no current value,
+ * EINVAL if it is not an integer or the BENCODE data is invalid and 
+ * ERANGE if it does not fit in an int64_t.
+ */
+int ambencode_cursor_get_int(struct bcursor *cursor, int64_t *value);
+
+/* Summary: Read the current value as a string, the string is not copied.
+ * cursor:  This is a pointer to an initialised cursor structure.
+ * ptr:     On success this is set to the string data within the buffer.
+ * len:     On success this is set to the length of the string in bytes.
+ *
+ * Return 0 on success and !0 on failure.
+ * The value of errno will be set to ENOENT if there is no current value
+ * and EINVAL if it is not a string or the BENCODE data is invalid.
+ */
+int ambencode_cursor_get_string(struct bcursor *cursor, char **ptr,
+				bsize_t *len);
+
+/* Summary: Set the maximum depth lists and dictionaries may be nested to.
+ * bhandle: This is a pointer to an initialised bhandle structure.
+ * depth:   The new maximum depth. Depths greater than AMBENCODE_MAXDEPTH
+ *          allocate a container stack which is released by ambencode_free()
+ *
+ * Return 0 on success and !0 on failure.
+ * The value of errno will be set to EINVAL if depth is less than 1 and
+ * ENOMEM if the container stack could not be allocated.
+ */
+int ambencode_maxdepth(struct bhandle *bhandle, int depth);
+
+/* Summary: Convert every integer to an int64_t as it is decoded, the value
+ *          is then read with BOBJECT_INT64() rather than converting it's
+ *          digits on every access. The values are held in a table 
+ *          parallel to the bobject pool, 8 bytes for every bobject, that
+ *          grows with it and is released by ambencode_free(). Integers 
+ *          that are changed with ambencode_update() are not converted.
+ * bhandle: This is a pointer to an initialised bhandle structure with an
+ *          empty pool, after ambencode_alloc() or ambencode_reset().
+ * enable:  !0 to convert integers, 0 to stop converting them and release
+ *          the table.
+ *
+ * Return 0 on success and !0 on failure.
+ * The value of errno will be set to EINVAL if the pool is not empty and
+ * ENOMEM if the table could not be allocated.
+ */
+int ambencode_integers(struct bhandle *bhandle, int enable);
+
+/* Summary: Return the value of a decoded integer, from the table kept by
+ *          ambencode_integers() or otherwise converted from it's digits.
+ * bhandle: This is a pointer to an initialised bhandle structure.
+ * bobject: This is a pointer to a bobject.
+ * value:   On success this is set to the integer.
+ *
+ * Return 0 on success and !0 on failure.
+ * The value of errno will be set to EINVAL if the bobject is not an 
+ * integer and ERANGE if it does not fit in an int64_t.
+ */
+int ambencode_get_i64(struct bhandle *bhandle, struct bobject *bobject,
+		      int64_t *value);
+
+/* Summary: Intern every dictionary key as it is decoded, each key is given
+ *          a symbol read with BOBJECT_SYMBOL() and equal keys are given
+ *          the same symbol. A key can then be resolved to it's symbol
+ *          once with ambencode_symbol() and found in many dictionaries
+ *          by comparing symbols rather than key bytes. The symbols are
+ *          held in a table parallel to the bobject pool, the interned 
+ *          keys refer to the DOM and are forgotten by ambencode_reset().
+ *          ambencode_parallel_document() decodes sequentially while 
+ *          keys are interned.
+ * bhandle: This is a pointer to an initialised bhandle structure with an
+ *          empty pool, after ambencode_alloc() or ambencode_reset().
+ * enable:  !0 to intern keys, 0 to stop interning them and release the 
+ *          tables.
+ *
+ * Return 0 on success and !0 on failure.
+ * The value of errno will be set to EINVAL if the pool is not empty and
+ * ENOMEM if the tables could not be allocated.
+ */
+int ambencode_intern(struct bhandle *bhandle, int enable);
+
+/* Summary: Return the symbol of a key, keys that have not been interned 
+ *          are not in any dictionary decoded since ambencode_intern() or
+ *          ambencode_reset() was called.
+ * bhandle: This is a pointer to an initialised bhandle structure.
+ * key:     This is a pointer to the key.
+ * len:     This is the length of the key in bytes.
+ *
+ * Return the symbol or 0 if the key has not been interned.
+ */
+bsize_t ambencode_symbol(struct bhandle *bhandle, const char *key,
+			 bsize_t len);
+
+/* Summary: Intern a string bobject as a dictionary key, for keys added
+ *          to a DOM after decoding. ambencode_intern() must have been
+ *          called.
+ * bhandle: This is a pointer to an initialised bhandle structure.
+ * key:     This is a pointer to a string bobject.
+ *
+ * Return the symbol of the key or 0 on failure.
+ * The value of errno will be set to ENOMEM if the key could not be 
+ * interned.
+ */
+bsize_t ambencode_intern_key(struct bhandle *bhandle, struct bobject *key);
+
+/* Summary: Record where each list and dictionary lies in the buffer it is
+ *          decoded from, read with BOBJECT_SPAN(). ambencode_dump() then
+ *          copies a container that has not changed from the buffer 
+ *          rather than encoding it again, so the buffer must outlive the
+ *          DOM. ambencode_decode() and ambencode_decode_tape() record
+ *          spans, containers decoded by ambencode_feed() and 
+ *          ambencode_decode_select() and those added afterwards have 
+ *          none. ambencode_parallel_document() 
+ *          decodes sequentially while spans are recorded.
+ * bhandle: This is a pointer to an initialised bhandle structure with an
+ *          empty pool, after ambencode_alloc() or ambencode_reset().
+ * enable:  !0 to record spans, 0 to stop recording them and release the
+ *          table.
+ *
+ * Return 0 on success and !0 on failure.
+ * The value of errno will be set to EINVAL if the pool is not empty and
+ * ENOMEM if the table could not be allocated.
+ */
+int ambencode_spans(struct bhandle *bhandle, int enable);
+
+/* Summary: Forget the spans of a bobject that has been changed and of 
+ *          every container holding it, they are encoded again by 
+ *          ambencode_dump() while their other members are still copied.
+ *          The containers are found through the parent of each, the 
+ *          first found already forgotten ends the walk as those holding
+ *          it were forgotten with it. The functions of 
+ *          extras/ambencode_mod.c call this for the bobjects they 
+ *          change.
+ * bhandle: This is a pointer to a bhandle holding a decoded DOM.
+ * bobject: The bobject changed.
+ */
+void ambencode_touch(struct bhandle *bhandle, struct bobject *bobject);
+
+/* Summary: Prepare an ambencode context for decoding another buffer,
+ *          reusing the bobject pool rather than calling ambencode_free()
+ *          and ambencode_alloc() for each buffer. Bobjects from the 
+ *          previous decode are no longer valid.
+ *          The number of bobjects decoded per byte is learnt from recent
+ *          decodes and used by ambencode_decode() to grow a managed pool
+ *          with a single reallocation. A managed pool that has become 
+ *          much larger than recent decodes require is shrunk.
+ * bhandle: This is a pointer to an initialised bhandle structure.
+ */
+void ambencode_reset(struct bhandle *bhandle);
+
 /* Summary: Release any resources held by an initialised ambencode context.
  * bhandle: This is a pointer to an initialised bhandle structure.
  */
@@ -0,0 +1,56 @@
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+#include <stdio.h>
+#include <string.h>
+
+#include "ambencode.h"
+#include "extras/ambencode_dump.h"
+#include "extras/ambencode_writer.h"
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+int main(int argc __attribute__((unused)),
+	 char **argv __attribute__((unused))) {
+
+  struct bhandle bhandle;
+  struct bwriter bwriter;
+  char ambencode[128];
+  char *tid;
+  size_t len;
+
+  /* Encode a DHT ping reply without building a DOM, the transaction id
+   * is reserved and filled in once the reply is encoded
+   */
+  ambencode_writer_init(&bwriter, ambencode, sizeof(ambencode), AMBENCODE_WRITER_CANONICAL);
+
+  ambencode_writer_dict_begin(&bwriter);
+  ambencode_writer_key(&bwriter, "r", 1);
+  ambencode_writer_dict_begin(&bwriter);
+  ambencode_writer_key(&bwriter, "id", 2);
+  ambencode_writer_str(&bwriter, "mnopqrstuvwxyz123456", 20);
+  ambencode_writer_end(&bwriter);
+  ambencode_writer_key(&bwriter, "t", 1);
+  tid = ambencode_writer_reserve(&bwriter, 2);
+  ambencode_writer_key(&bwriter, "y", 1);
+  ambencode_writer_str(&bwriter, "r", 1);
+  ambencode_writer_end(&bwriter);
+
+  if (ambencode_writer_finish(&bwriter, &len) != 0) return 1;
+
+  memcpy(tid, "aa", 2);
+  printf("%.*s\n", (int)len, ambencode);
+  fflush(stdout);
+
+  if (ambencode_alloc(&bhandle, (void *)0, 32) == 0) {
+    if (ambencode_decode(&bhandle, ambencode, (xbsize_t)len) == 0) {
+      ambencode_dump(&bhandle, BOBJECT_ROOT(&bhandle), 1, (char *)0, 0);
+      printf("\n");
+    }
+    ambencode_free(&bhandle);
+  }
+
+  return 0;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
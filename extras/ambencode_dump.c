@@ -22,9 +22,11 @@ OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR
 THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 
  * -------------------------------------------------------------------- */
-
 #include <unistd.h>
+#include <sys/uio.h>
+#include <stddef.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <errno.h>
 
@@ -34,12 +36,16 @@ THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 /* -------------------------------------------------------------------- */
 /* -------------------------------------------------------------------- */
 
-static void dump_spaces(int count, size_t *written, char *buf, size_t len);
+static void dump_spaces(int count, struct bsink *sink);
 static void dump_json(struct bhandle *bhandle, struct bobject *bobject,
-		 int type, int depth, int pretty, size_t *written,
-		 char *buf, size_t len);
-static size_t cpyout(char *dst, size_t dlen, char *src, size_t slen, 
-		     size_t offset);
+		 int type, int depth, int pretty, struct bsink *sink);
+static void sink_put(struct bsink *sink, const char *ptr, size_t len);
+static void sink_overflow(struct bsink *sink, const char *ptr, size_t len);
+static int sink_write(struct bsink *sink, const char *ptr, size_t len);
+static int sink_writev(int fd, struct iovec *iov, int count);
+static void sink_length(struct bsink *sink, size_t value);
+static int dump_span(struct bhandle *bhandle, struct bobject *bobject, 
+		     struct bsink *sink);
 
 /* -------------------------------------------------------------------- */
 /* -------------------------------------------------------------------- */
@@ -51,109 +57,371 @@ static char *spaces[] = {
   "            ","              "
 };
 
+/* Writes no longer than this are copied into a sink, longer writes are
+ * output directly once it is full
+ */
+#define SINK_COPYMAX (BSINK_SIZE / 4)
+
+static const char digits[] = 
+  "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+  "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+  "8081828384858687888990919293949596979899";
+
 /* -------------------------------------------------------------------- */
 /* -------------------------------------------------------------------- */
-static void dump_spaces(int depth, size_t *written, char *buf, size_t len) {
+void ambencode_sink_fd(struct bsink *sink, int fd) {
 
-  if (depth == 0) return;
-  
-  if (depth < MAX_SPACECOUNT) {
-    *written += cpyout(buf, len, spaces[depth], depth*2, *written);
-  } else {    
+  memset(sink, 0, offsetof(struct bsink, buffer));
 
-    for (;;) {
-      *written += cpyout(buf, len, spaces[MAX_SPACECOUNT-1], (MAX_SPACECOUNT-1)*2, *written);
-      
-      depth -= MAX_SPACECOUNT-1;
-      if (depth < MAX_SPACECOUNT) break;     
-    }
+  sink->type = BSINK_FD;
+  sink->fd   = fd;
+  sink->buf  = sink->buffer;
+  sink->len  = BSINK_SIZE;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+void ambencode_sink_file(struct bsink *sink, FILE *fp) {
+
+  memset(sink, 0, offsetof(struct bsink, buffer));
+
+  sink->type = BSINK_FILE;
+  sink->fp   = fp;
+  sink->buf  = sink->buffer;
+  sink->len  = BSINK_SIZE;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+void ambencode_sink_memory(struct bsink *sink) {
+
+  memset(sink, 0, offsetof(struct bsink, buffer));
+
+  sink->type = BSINK_MEMORY;
+  sink->buf  = sink->buffer;
+  sink->len  = BSINK_SIZE;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+void ambencode_sink_buffer(struct bsink *sink, char *buf, size_t len) {
+
+  memset(sink, 0, offsetof(struct bsink, buffer));
+
+  sink->type = BSINK_BUFFER;
+  sink->buf  = buf;
+  sink->len  = len;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+void ambencode_sink_callback(struct bsink *sink, 
+			     int (*callback)(void *ctx, const char *ptr, size_t len),
+			     void *ctx) {
+
+  memset(sink, 0, offsetof(struct bsink, buffer));
+
+  sink->type     = BSINK_CALLBACK;
+  sink->callback = callback;
+  sink->ctx      = ctx;
+  sink->buf      = sink->buffer;
+  sink->len      = BSINK_SIZE;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+void ambencode_sink_write(struct bsink *sink, const char *ptr, size_t len) {
+
+  sink_put(sink, ptr, len);
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+int ambencode_sink_flush(struct bsink *sink) {
+
+  if ((sink->type == BSINK_FD) || (sink->type == BSINK_FILE) ||
+      (sink->type == BSINK_CALLBACK)) {
+
+    sink_write(sink, (char *)0, 0);
+    sink->used = 0;
+
+    if ((sink->type == BSINK_FILE) && (!sink->error) && 
+	(fflush(sink->fp) != 0)) sink->error = errno;
+  }
 
-    dump_spaces(depth, written, buf, len);
+  if (sink->error) {
+    errno = sink->error;
+    return -1;
   }
+
+  return 0;
 }
 
 /* -------------------------------------------------------------------- */
 /* -------------------------------------------------------------------- */
-static size_t cpyout(char *dst, size_t dlen, char *src, size_t slen, 
-		     size_t offset) {
+void ambencode_sink_free(struct bsink *sink) {
 
-  if (dst == (char *)0) {
+  if ((sink->type != BSINK_MEMORY) || (sink->buf == sink->buffer)) return;
 
-    ssize_t written;
-    size_t towrite = slen;
-    char *ptr = src;
+  free(sink->buf);
 
+  sink->buf  = sink->buffer;
+  sink->len  = BSINK_SIZE;
+  sink->used = 0;
+}
 
-    while (towrite) {
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static void sink_put(struct bsink *sink, const char *ptr, size_t len) {
 
-      do {
-	written = write(1, ptr, towrite);
-      } while ((written == -1) && (errno == EINTR));
-      
-      if (written == -1) return slen;
+  sink->written += len;
+
+  if (len <= sink->len - sink->used) {
+    memcpy(&sink->buf[sink->used], ptr, len);
+    sink->used += len;
+  } else {
+    sink_overflow(sink, ptr, len);
+  }
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static void sink_overflow(struct bsink *sink, const char *ptr, size_t len) {
+
+  /* The bytes do not fit what is left of the sink's buffer
+   */
+  size_t size;
+  char *buf;
+
+  if (sink->error) return;
+
+  switch (sink->type) {
+  case BSINK_BUFFER:
+
+    memcpy(&sink->buf[sink->used], ptr, sink->len - sink->used);
+    sink->used = sink->len;
+    break;
 
-      towrite -= written;
-      ptr     += written;
+  case BSINK_MEMORY:
+
+    /* Output is held by the sink until it outgrows it
+     */
+    for (size = sink->len * 2; size - sink->used < len; size *= 2);
+
+    if (sink->buf == sink->buffer) {
+      if ((buf = (char *)malloc(size))) memcpy(buf, sink->buffer, sink->used);
+    } else {
+      buf = (char *)realloc(sink->buf, size);
     }
+
+    if (!buf) {
+      sink->error = ENOMEM;
+      return;
+    }
+
+    sink->buf  = buf;
+    sink->len  = size;
+    memcpy(&sink->buf[sink->used], ptr, len);
+    sink->used += len;
+    break;
+
+  default:
+
+    /* Short writes are copied once the held bytes have been output,
+     * longer writes are output with them
+     */
+    if (len <= SINK_COPYMAX) {
+      if (sink_write(sink, (char *)0, 0) != 0) return;
+      memcpy(sink->buf, ptr, len);
+      sink->used = len;
+    } else {
+      sink_write(sink, ptr, len);
+      sink->used = 0;
+    }
+    break;
+  }
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static int sink_write(struct bsink *sink, const char *ptr, size_t len) {
+
+  /* Output the bytes held by the sink followed by len bytes of ptr
+   */
+  struct iovec iov[2];
+
+  if (sink->error) return -1;
+
+  switch (sink->type) {
+  case BSINK_FD:
+
+    iov[0].iov_base = sink->buf;
+    iov[0].iov_len  = sink->used;
+    iov[1].iov_base = (char *)ptr;
+    iov[1].iov_len  = len;
     
+    if (sink_writev(sink->fd, iov, 2) != 0) goto fail;
+    break;
+
+  case BSINK_FILE:
+
+    if (((sink->used) && 
+	 (fwrite(sink->buf, 1, sink->used, sink->fp) != sink->used)) ||
+	((len) && 
+	 (fwrite(ptr, 1, len, sink->fp) != len))) goto fail;
+    break;
+
+  case BSINK_CALLBACK:
+
+    if (((sink->used) && (sink->callback(sink->ctx, sink->buf, sink->used) != 0)) ||
+	((len) && (sink->callback(sink->ctx, ptr, len) != 0))) {
+      errno = EIO;
+      goto fail;
+    }
+    break;
+  }
+
+  sink->used = 0;
+  return 0;
+
+ fail:
+  sink->error = errno;
+  return -1;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static int sink_writev(int fd, struct iovec *iov, int count) {
+
+  ssize_t written;
+
+  /* Skip the vectors written in full and resume within a partly written 
+   * vector until nothing is left
+   */
+  while (count) {
+
+    do {
+      written = writev(fd, iov, count);
+    } while ((written == -1) && (errno == EINTR));
+
+    if (written == -1) return -1;
+
+    while ((count) && ((size_t)written >= iov->iov_len)) {
+      written -= iov->iov_len;
+      iov++;
+      count--;
+    }
+
+    if (count) {
+      iov->iov_base = (char *)iov->iov_base + written;
+      iov->iov_len -= written;
+    }
+  }
+
+  return 0;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static void sink_length(struct bsink *sink, size_t value) {
+
+  /* Put a string's length prefix and it's ':', the digits are formed 
+   * from the end two at a time
+   */
+  char buf[24];
+  char *ptr = &buf[sizeof(buf) - 1];
+
+  *ptr = ':';
+
+  while (value >= 100) {
+    const size_t pair = (value % 100) * 2;
+
+    value /= 100;
+    *--ptr = digits[pair + 1];
+    *--ptr = digits[pair];
+  }
+
+  if (value >= 10) {
+    *--ptr = digits[value * 2 + 1];
+    *--ptr = digits[value * 2];
   } else {
+    *--ptr = (char)('0' + value);
+  }
 
-    if (offset < dlen) {
-      
-      size_t towrite   = 0;
-      size_t available = dlen - offset;
-      
-      towrite = slen;
-      if (towrite > available) {
-	towrite = available;
-      }
+  sink_put(sink, ptr, &buf[sizeof(buf)] - ptr);
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static void dump_spaces(int depth, struct bsink *sink) {
+
+  if (depth == 0) return;
+  
+  if (depth < MAX_SPACECOUNT) {
+    sink_put(sink, spaces[depth], depth*2);
+  } else {    
+
+    for (;;) {
+      sink_put(sink, spaces[MAX_SPACECOUNT-1], (MAX_SPACECOUNT-1)*2);
       
-      if (towrite > 0) memcpy(&dst[offset], src, towrite);
+      depth -= MAX_SPACECOUNT-1;
+      if (depth < MAX_SPACECOUNT) break;     
     }
+
+    dump_spaces(depth, sink);
   }
+}
 
-  return slen;
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static int dump_span(struct bhandle *bhandle, struct bobject *bobject, 
+		     struct bsink *sink) {
+
+  /* A container that has not changed since it was decoded is copied 
+   * from the buffer, a long span is not copied into the sink but output
+   * directly by it
+   */
+  const struct bspan *span;
+
+  if (!bhandle->span) return 0;
+
+  span = BOBJECT_SPAN(bhandle, bobject);
+  if (!span->len) return 0;
+
+  sink_put(sink, span->ptr, span->len);
+  return 1;
 }
 
 /* -------------------------------------------------------------------- */
 /* -------------------------------------------------------------------- */
 static void dump(struct bhandle *bhandle, struct bobject *bobject,
 		 int type __attribute__((unused)), 
-		 int depth, int pretty, size_t *written,
-		 char *buf, size_t len) {
+		 int depth, int pretty, struct bsink *sink) {
 
   while (bobject) {
 
     switch (BOBJECT_TYPE(bobject)) {
 
-    case AMBENCODE_STRING: {
-
-      char nbuf[20];
-      size_t nlen = sprintf(nbuf, "%ld", (size_t)BOBJECT_STRING_LEN(bobject));
-
-      *written += cpyout(buf, len, nbuf, nlen, *written);
-      *written += cpyout(buf, len, ":", 1, *written);
-      *written += cpyout(buf, len, 
-			 BOBJECT_STRING_PTR(bhandle, bobject), BOBJECT_STRING_LEN(bobject), 
-			 *written);
+    case AMBENCODE_STRING:
+      sink_length(sink, BOBJECT_STRING_LEN(bobject));
+      sink_put(sink, BOBJECT_STRING_PTR(bhandle, bobject), BOBJECT_STRING_LEN(bobject));
       break;
-    }
     case AMBENCODE_NUMBER:
-      *written += cpyout(buf, len, "i", 1, *written);
-      *written += cpyout(buf, len, 
-			 BOBJECT_STRING_PTR(bhandle, bobject), BOBJECT_STRING_LEN(bobject), 
-			 *written);
-      *written += cpyout(buf, len, "e", 1, *written);
+      sink_put(sink, "i", 1);
+      sink_put(sink, BOBJECT_STRING_PTR(bhandle, bobject), BOBJECT_STRING_LEN(bobject));
+      sink_put(sink, "e", 1);
       break;
     case AMBENCODE_DICTIONARY:
-      *written += cpyout(buf, len, "d", 1, *written);
-      dump(bhandle, DICTIONARY_FIRST_KEY(bhandle, bobject), AMBENCODE_DICTIONARY, depth+1, pretty, written, buf, len);
-      *written += cpyout(buf, len, "e", 1, *written);
+      if (dump_span(bhandle, bobject, sink)) break;
+      sink_put(sink, "d", 1);
+      dump(bhandle, DICTIONARY_FIRST_KEY(bhandle, bobject), AMBENCODE_DICTIONARY, depth+1, pretty, sink);
+      sink_put(sink, "e", 1);
       break;
     case AMBENCODE_LIST:
-      *written += cpyout(buf, len, "l", 1, *written);
-      dump(bhandle, LIST_FIRST(bhandle, bobject), AMBENCODE_LIST, depth+1, pretty, written, buf, len);
-      *written += cpyout(buf, len, "e", 1, *written);
+      if (dump_span(bhandle, bobject, sink)) break;
+      sink_put(sink, "l", 1);
+      dump(bhandle, LIST_FIRST(bhandle, bobject), AMBENCODE_LIST, depth+1, pretty, sink);
+      sink_put(sink, "e", 1);
       break;
     }
 
@@ -168,46 +436,41 @@ static void dump(struct bhandle *bhandle, struct bobject *bobject,
 /* -------------------------------------------------------------------- */
 /* -------------------------------------------------------------------- */
 static void dump_json(struct bhandle *bhandle, struct bobject *bobject,
-		 int type, int depth, int pretty, size_t *written,
-		 char *buf, size_t len) {
+		 int type, int depth, int pretty, struct bsink *sink) {
 
   char *sep = "";
     
   while (bobject) {
 
-    *written += cpyout(buf, len, sep, strlen(sep), *written);
+    sink_put(sink, sep, strlen(sep));
 
     if ((pretty) && (*sep != ':')) {
-      dump_spaces(depth, written, buf, len);
+      dump_spaces(depth, sink);
     }
     
     switch (BOBJECT_TYPE(bobject)) {
 
     case AMBENCODE_STRING:
-      *written += cpyout(buf, len, 
-			 BOBJECT_STRING_PTR(bhandle, bobject), BOBJECT_STRING_LEN(bobject), 
-			 *written);
+      sink_put(sink, BOBJECT_STRING_PTR(bhandle, bobject), BOBJECT_STRING_LEN(bobject));
       break;
     case AMBENCODE_NUMBER:
-      *written += cpyout(buf, len, 
-			 BOBJECT_STRING_PTR(bhandle, bobject), BOBJECT_STRING_LEN(bobject), 
-			 *written);
+      sink_put(sink, BOBJECT_STRING_PTR(bhandle, bobject), BOBJECT_STRING_LEN(bobject));
       break;
     case AMBENCODE_DICTIONARY:
-      *written += cpyout(buf, len, "{", 1, *written);
-      if (pretty) *written += cpyout(buf, len, "\n", 1, *written);
-      dump_json(bhandle, DICTIONARY_FIRST_KEY(bhandle, bobject), AMBENCODE_DICTIONARY, depth+1, pretty, written, buf, len);
-      if (pretty) *written += cpyout(buf, len, "\n", 1, *written);
-      if (pretty) dump_spaces(depth, written, buf, len);
-      *written += cpyout(buf, len, "}", 1, *written);
+      sink_put(sink, "{", 1);
+      if (pretty) sink_put(sink, "\n", 1);
+      dump_json(bhandle, DICTIONARY_FIRST_KEY(bhandle, bobject), AMBENCODE_DICTIONARY, depth+1, pretty, sink);
+      if (pretty) sink_put(sink, "\n", 1);
+      if (pretty) dump_spaces(depth, sink);
+      sink_put(sink, "}", 1);
       break;
     case AMBENCODE_LIST:
-      *written += cpyout(buf, len, "[", 1, *written);
-      if (pretty) *written += cpyout(buf, len, "\n", 1, *written);
-      dump_json(bhandle, LIST_FIRST(bhandle, bobject), AMBENCODE_LIST, depth+1, pretty, written, buf, len);
-      if (pretty) *written += cpyout(buf, len, "\n", 1, *written);
-      if (pretty) dump_spaces(depth, written, buf, len);
-      *written += cpyout(buf, len, "]", 1, *written);
+      sink_put(sink, "[", 1);
+      if (pretty) sink_put(sink, "\n", 1);
+      dump_json(bhandle, LIST_FIRST(bhandle, bobject), AMBENCODE_LIST, depth+1, pretty, sink);
+      if (pretty) sink_put(sink, "\n", 1);
+      if (pretty) dump_spaces(depth, sink);
+      sink_put(sink, "]", 1);
       break;
     }
 
@@ -236,14 +499,48 @@ static void dump_json(struct bhandle *bhandle, struct bobject *bobject,
 
 /* -------------------------------------------------------------------- */
 /* -------------------------------------------------------------------- */
-size_t ambencode_dump_json(struct bhandle *bhandle, struct bobject *bobject, 
-		      int pretty, char *buf, size_t len) {
+size_t ambencode_dump_json_sink(struct bhandle *bhandle, struct bobject *bobject,
+				int pretty, struct bsink *sink) {
+
+  const size_t written = sink->written;
+
+  if (!bobject) bobject = BOBJECT_ROOT(bhandle);
+  
+  dump_json(bhandle, bobject, BOBJECT_TYPE(bobject), 0, pretty, sink);
+
+  return sink->written - written;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+size_t ambencode_dump_sink(struct bhandle *bhandle, struct bobject *bobject,
+			   int pretty, struct bsink *sink) {
 
-  size_t written = 0;
+  const size_t written = sink->written;
 
   if (!bobject) bobject = BOBJECT_ROOT(bhandle);
   
-  dump_json(bhandle, bobject, BOBJECT_TYPE(bobject), 0, pretty, &written, buf, len);
+  dump(bhandle, bobject, BOBJECT_TYPE(bobject), 0, pretty, sink);
+
+  return sink->written - written;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+size_t ambencode_dump_json(struct bhandle *bhandle, struct bobject *bobject, 
+		      int pretty, char *buf, size_t len) {
+
+  struct bsink sink;
+  size_t written;
+
+  if (buf) {
+    ambencode_sink_buffer(&sink, buf, len);
+  } else {
+    ambencode_sink_fd(&sink, 1);
+  }
+
+  written = ambencode_dump_json_sink(bhandle, bobject, pretty, &sink);
+  ambencode_sink_flush(&sink);
 
   return written;
 }
@@ -253,11 +550,17 @@ size_t ambencode_dump_json(struct bhandle *bhandle, struct bobject *bobject,
 size_t ambencode_dump(struct bhandle *bhandle, struct bobject *bobject, 
 		      int pretty, char *buf, size_t len) {
 
-  size_t written = 0;
+  struct bsink sink;
+  size_t written;
 
-  if (!bobject) bobject = BOBJECT_ROOT(bhandle);
-  
-  dump(bhandle, bobject, BOBJECT_TYPE(bobject), 0, pretty, &written, buf, len);
+  if (buf) {
+    ambencode_sink_buffer(&sink, buf, len);
+  } else {
+    ambencode_sink_fd(&sink, 1);
+  }
+
+  written = ambencode_dump_sink(bhandle, bobject, pretty, &sink);
+  ambencode_sink_flush(&sink);
 
   return written;
 }
@@ -26,10 +26,38 @@ THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 #ifndef _AMBENCODE_DUMP_H_
 #define _AMBENCODE_DUMP_H_
 
+#include <stdio.h>
+
 #include "ambencode.h"
 
 /* -------------------------------------------------------------------- */
 
+#define BSINK_SIZE     8192       /* Bytes combined before they are output */
+
+#define BSINK_FD       0          /* Output to a file descriptor */
+#define BSINK_FILE     1          /* Output to a stdio stream */
+#define BSINK_MEMORY   2          /* Output to a buffer grown as needed */
+#define BSINK_BUFFER   3          /* Output to a fixed buffer, truncated */
+#define BSINK_CALLBACK 4          /* Output to a user callback */
+
+struct bsink {
+
+  int            type;            /* One of BSINK_FD to BSINK_CALLBACK */
+  int            fd;              /* Descriptor of a BSINK_FD sink */
+  FILE           *fp;             /* Stream of a BSINK_FILE sink */
+  int            (*callback)(void *ctx, const char *ptr, size_t len);
+  void           *ctx;            /* Passed to callback */
+  char           *buf;            /* Bytes not yet output, or every byte
+				   * of a memory or fixed buffer sink */
+  size_t         len;             /* Size of buf */
+  size_t         used;            /* Bytes held in buf */
+  size_t         written;         /* Bytes put, including any truncated */
+  int            error;           /* errno of the first failure or 0 */
+  char           buffer[BSINK_SIZE];
+};
+
+/* -------------------------------------------------------------------- */
+
 #ifdef __cplusplus
 extern "C" {  
 #endif
@@ -42,6 +70,73 @@ size_t ambencode_dump(struct bhandle *bhandle, struct bobject *bobject,
 size_t ambencode_dump_json(struct bhandle *bhandle, struct bobject *bobject, 
 			   int pretty, char *buf, size_t len);
 
+/* Summary: Initialise a sink that ambencode_dump_sink() and
+ *          ambencode_dump_json_sink() output through. Small writes are
+ *          combined in the sink and output together, long strings are 
+ *          output with the bytes before them by a single writev() 
+ *          rather than being copied. 
+ *          ambencode_sink_fd()       outputs to a file descriptor.
+ *          ambencode_sink_file()     outputs to a stdio stream.
+ *          ambencode_sink_memory()   collects the output in sink->buf, 
+ *                                    sink->used bytes long, that is 
+ *                                    held by the sink until it grows
+ *                                    and is then released by 
+ *                                    ambencode_sink_free().
+ *          ambencode_sink_buffer()   collects the output in buf, output
+ *                                    beyond len bytes is dropped but is
+ *                                    still counted.
+ *          ambencode_sink_callback() passes the output to callback, 
+ *                                    which returns !0 on failure.
+ * sink:    This is a pointer to an uninitialised bsink structure.
+ */
+void ambencode_sink_fd(struct bsink *sink, int fd);
+void ambencode_sink_file(struct bsink *sink, FILE *fp);
+void ambencode_sink_memory(struct bsink *sink);
+void ambencode_sink_buffer(struct bsink *sink, char *buf, size_t len);
+void ambencode_sink_callback(struct bsink *sink, 
+			     int (*callback)(void *ctx, const char *ptr, size_t len),
+			     void *ctx);
+
+/* Summary: Put bytes to a sink, such as separators between documents.
+ * sink:    This is a pointer to an initialised bsink structure.
+ * ptr:     This is a pointer to the bytes.
+ * len:     This is the count of bytes.
+ */
+void ambencode_sink_write(struct bsink *sink, const char *ptr, size_t len);
+
+/* Summary: Output any bytes the sink is holding, a stdio stream is also
+ *          flushed. Output is only complete once this has been called.
+ * sink:    This is a pointer to an initialised bsink structure.
+ *
+ * Return 0 on success and !0 on failure, in which case errno is set to
+ * that of the first failure of the sink, EIO for a callback. Output 
+ * after a failure is dropped.
+ */
+int ambencode_sink_flush(struct bsink *sink);
+
+/* Summary: Release the buffer of a memory sink, other sinks hold nothing.
+ * sink:    This is a pointer to an initialised bsink structure.
+ */
+void ambencode_sink_free(struct bsink *sink);
+
+/* Summary: Output bobject, or the root if bobject is NULL, through a sink
+ *          as BENCODE or JSON. Documents output through the same sink 
+ *          are combined until it is flushed. ambencode_dump() and 
+ *          ambencode_dump_json() output through a buffer sink or, when
+ *          buf is NULL, through a sink on descriptor 1 that they flush.
+ * bhandle: This is a pointer to a bhandle holding a decoded DOM.
+ * bobject: The bobject to output or NULL.
+ * pretty:  !0 to indent JSON output.
+ * sink:    This is a pointer to an initialised bsink structure.
+ *
+ * Return the count of bytes output.
+ */
+size_t ambencode_dump_sink(struct bhandle *bhandle, struct bobject *bobject,
+			   int pretty, struct bsink *sink);
+
+size_t ambencode_dump_json_sink(struct bhandle *bhandle, struct bobject *bobject,
+				int pretty, struct bsink *sink);
+
 /* -------------------------------------------------------------------- */
 /* -------------------------------------------------------------------- */
 
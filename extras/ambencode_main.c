@@ -32,6 +32,7 @@ THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 #include <unistd.h>
 #include <time.h>
 #include <stdio.h>
+#include <inttypes.h>
 #include <string.h>
 #include <stdlib.h>
 #include <errno.h>
@@ -44,6 +45,102 @@ THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 #include "extras/ambencode_file.h"
 #include "extras/ambencode_dump.h"
 #include "extras/ambencode_query.h"
+#include "extras/ambencode_parallel.h"
+#include "extras/ambencode_writer.h"
+
+/* -------------------------------------------------------------------- */
+
+#define FEED_CHUNK (64 * 1024)    /* Bytes read from stdin at a time */
+
+#define POOL_NONE  0              /* Benchmark without a bobject pool */
+#define POOL_ALLOC 1              /* Allocate and free a pool every decode */
+#define POOL_RESET 2              /* Reset one pool between decodes */
+#define POOL_COUNT 3              /* Count bobjects, allocate an exact pool */
+#define POOL_MAPPED 4             /* Map and unmap a pool every decode */
+
+static int parallel_threads = 1;  /* Threads used by parallel() and document() */
+
+#ifdef AMBENCODE_SOA
+#define POOL_LAYOUT "soa"         /* Pool layout reported by benchmark_walk() */
+#else
+#define POOL_LAYOUT "aos"
+#endif
+
+#define WALK_TREE  0              /* Visit every value through it's links */
+#define WALK_SCAN  1              /* Count the types of every bobject */
+
+struct bmatch {
+
+  struct bhandle *bhandle;        /* DOM queried */
+  struct bsink   sink;            /* Output of every value matched */
+};
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static int query_match(void *ctx, int path __attribute__((unused)), 
+		       struct bobject *bobject) {
+
+  /* Output each value a query matches, one per line, through a sink 
+   * shared by every match
+   */
+  struct bmatch *bmatch = (struct bmatch *)ctx;
+
+  ambencode_dump_sink(bmatch->bhandle, bobject, 1, &bmatch->sink);
+  ambencode_sink_write(&bmatch->sink, "\n", 1);
+
+  return (bmatch->sink.error)?-1:0;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static int query_output(struct bhandle *bhandle, char *query) {
+
+  /* Queries may match many values or aggregate them, an aggregate is 
+   * output as a single integer
+   */
+  struct baggregate aggregate;
+  struct bquery bquery;
+  struct bmatch bmatch;
+  int rc = 1;
+
+  if (ambencode_query_compile(&bquery, &query, 1) != 0) goto fail;
+
+  if (bquery.function[0] == BQUERY_NONE) {
+
+    bmatch.bhandle = bhandle;
+    ambencode_sink_fd(&bmatch.sink, 1);
+
+    if (ambencode_query_each(bhandle, BOBJECT_ROOT(bhandle), &bquery, 
+			     query_match, &bmatch) == 0) goto fail;
+    if (ambencode_sink_flush(&bmatch.sink) != 0) goto fail;
+    rc = 0;
+    goto fail;
+  }
+
+  ambencode_query_aggregate(bhandle, BOBJECT_ROOT(bhandle), &bquery, &aggregate);
+
+  if (bquery.function[0] == BQUERY_COUNT) {
+    fprintf(stdout, "%lu\n", aggregate.count);
+  } else if (aggregate.count == 0) {
+    goto fail;
+  } else if (aggregate.overflow) {
+    fprintf(stderr, "'%s' integer overflow\n", query);
+    goto fail;
+  } else if (bquery.function[0] == BQUERY_SUM) {
+    fprintf(stdout, "%" PRId64 "\n", aggregate.sum);
+  } else if (aggregate.integers == 0) {
+    goto fail;
+  } else {
+    fprintf(stdout, "%" PRId64 "\n", (bquery.function[0] == BQUERY_MIN)?
+	    aggregate.min:aggregate.max);
+  }
+  rc = 0;
+
+ fail:
+  if (rc != 0) fprintf(stderr, "'%s' not found\n", query);
+  ambencode_query_free(&bquery);
+  return rc;
+}
 
 /* -------------------------------------------------------------------- */
 /* -------------------------------------------------------------------- */
@@ -53,79 +150,374 @@ static double tstos(struct timespec* ts) {
 
 /* -------------------------------------------------------------------- */
 /* -------------------------------------------------------------------- */
-static int local_mkstemp(char *tmpfile) {
+static int feed_stdin(struct bhandle *bhandle) {
+
+  /* Parse stdin as it is read, the chunk buffer is reused for every read
+   * as ambencode_feed() copies everything it needs into the pool.
+   */
+  ssize_t bytes_read;
+  char buf[FEED_CHUNK];
+
+  for (;;) {
 
-  int value = getpid();
-  int len   = strlen(tmpfile);
-  int fd    = -1;
-  
-  while (fd == -1) {
-   
-    sprintf(&tmpfile[len-6], "%.6d", value);
-  
     do {
+      bytes_read = read(0, buf, sizeof(buf));
+    } while ((bytes_read == -1) && (errno == EINTR));
+
+    if (bytes_read == -1) return -1;
+    if (bytes_read == 0) break;
+
+    if (ambencode_feed(bhandle, buf, (xbsize_t)bytes_read) != 0) return -1;
+  }
+
+  return ambencode_feed_end(bhandle);
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static int validate(struct bhandle *bhandle __attribute__((unused)),
+		    char *buf, xbsize_t len) {
+
+  /* ambencode_validate() needs no bobject pool
+   */
+  struct berror error;
+  
+  return ambencode_validate((struct bhandle *)0, buf, len, &error);
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static int parallel(struct bhandle *bhandle __attribute__((unused)),
+		    char *buf, xbsize_t len) {
+
+  /* ambencode_parallel_decode() allocates a bhandle for each piece
+   */
+  struct bparallel bparallel;
+
+  if (ambencode_parallel_decode(&bparallel, buf, len, parallel_threads) != 0) return -1;
+
+  ambencode_parallel_free(&bparallel);
+  return 0;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static int document(struct bhandle *bhandle, char *buf, xbsize_t len) {
+
+  return ambencode_parallel_document(bhandle, buf, len, parallel_threads);
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static int tape(struct bhandle *bhandle, char *buf, xbsize_t len) {
+
+  return ambencode_decode_tape(bhandle, buf, len, AMBENCODE_TAPE_INDEX);
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static int project(struct bhandle *bhandle, char *buf, xbsize_t len, char *query,
+		   int *projected) {
+
+  /* Only the values on the path of a query are decoded, a query that
+   * does not compile is left for query_output() to report and the 
+   * buffer is decoded in full
+   */
+  struct bquery bquery;
+  int rc;
+
+  *projected = 0;
+  if (ambencode_query_compile(&bquery, &query, 1) != 0) return ambencode_decode(bhandle, buf, len);
+
+  *projected = 1;
+  rc = ambencode_query_decode(bhandle, buf, len, &bquery);
+  ambencode_query_free(&bquery);
+
+  return rc;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static unsigned long walk_tree(struct bhandle *bhandle, struct bobject *bobject) {
 
-      fd = open(tmpfile, O_RDWR|O_CREAT|O_EXCL, 0644);
-    } while ((fd == -1) && (errno == EINTR));
-    
-    if (fd == -1) {
-      if (errno != EEXIST) return -1;
+  /* Visit every value below bobject in the order ambencode_dump() does, 
+   * reading the type, length and links of each
+   */
+  unsigned long visited = 1;
+  struct bobject *child;
+
+  if (BOBJECT_TYPE(bobject) >= AMBENCODE_STRING) {
+    return visited + BOBJECT_STRING_LEN(bobject);
+  }
+
+  for (child = LIST_FIRST(bhandle, bobject); child; child = LIST_NEXT(bhandle, child)) {
+    visited += walk_tree(bhandle, child);
+  }
+  return visited;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static unsigned long walk_scan(struct bhandle *bhandle) {
+
+  /* Count the containers in the pool, reading only the type of each
+   * bobject
+   */
+  unsigned long containers = 0;
+  poff_t i;
+
+  for (i=0; i<bhandle->used; i++) {
+    containers += (BOBJECT_TYPE(BOBJECT_AT(bhandle, i)) < AMBENCODE_STRING);
+  }
+  return containers;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static int benchmark_walk(struct bhandle *bhandle, const char *name, int how) {
+
+  /* Walk a decoded pool repeatedly for at least a second, as 
+   * benchmark_decode() does for decoding
+   */
+  struct timespec start;
+  struct timespec end;
+  double elapsed = 0.0;
+  double best    = 0.0;
+  long   walks   = 0;
+  long   batch   = 1;
+  unsigned long result = 0;
+
+  while (elapsed < 1.0) {
+
+    struct bobject *bobject;
+    double seconds;
+    long i;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (i=0; i<batch; i++) {
+      if (how == WALK_SCAN) {
+	result += walk_scan(bhandle);
+      } else {
+	for (bobject = BOBJECT_FIRST(bhandle); bobject; bobject = BOBJECT_NEXT(bhandle, bobject)) {
+	  result += walk_tree(bhandle, bobject);
+	}
+      }
     }
-    
-    value++;
-    if (value > 999999) {
-      value = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    seconds = tstos(&end) - tstos(&start);
+
+    if ((walks == 0) || ((seconds / batch) < best)) {
+      best = seconds / batch;
     }
+    elapsed += seconds;
+    walks   += batch;
+
+    if (seconds < 0.001) batch *= 2;
   }
 
-  return fd;
+  fprintf(stdout, "%s layout:%s Walks:%ld Average seconds:%.9f Best seconds:%.9f Bobjects/s:%.0f%s\n",
+	  name, POOL_LAYOUT, walks, elapsed / walks, best, bhandle->used / best,
+	  (result == 0)?" (empty)":"");
+  return 0;
 }
 
 /* -------------------------------------------------------------------- */
 /* -------------------------------------------------------------------- */
-static int copy_stdin(char *tmpfile) {
+static void writer_tree(struct bwriter *bwriter, struct bhandle *bhandle, 
+			struct bobject *bobject) {
+
+  /* Write the values below bobject as they were decoded, failures are
+   * kept by the writer
+   */
+  struct bobject *child;
+  int64_t value;
+
+  switch (BOBJECT_TYPE(bobject)) {
+  case AMBENCODE_DICTIONARY:
+    ambencode_writer_dict_begin(bwriter);
+    for (child = DICTIONARY_FIRST_KEY(bhandle, bobject); child; 
+	 child = DICTIONARY_NEXT_KEY(bhandle, child)) {
+      ambencode_writer_key(bwriter, BOBJECT_STRING_PTR(bhandle, child), BOBJECT_STRING_LEN(child));
+      writer_tree(bwriter, bhandle, BOBJECT_AT(bhandle, BOBJECT_LINK(bhandle, child)));
+    }
+    ambencode_writer_end(bwriter);
+    break;
+  case AMBENCODE_LIST:
+    ambencode_writer_list_begin(bwriter);
+    for (child = LIST_FIRST(bhandle, bobject); child; child = LIST_NEXT(bhandle, child)) {
+      writer_tree(bwriter, bhandle, child);
+    }
+    ambencode_writer_end(bwriter);
+    break;
+  case AMBENCODE_STRING:
+    ambencode_writer_str(bwriter, BOBJECT_STRING_PTR(bhandle, bobject), BOBJECT_STRING_LEN(bobject));
+    break;
+  default:
+    if (ambencode_get_i64(bhandle, bobject, &value) != 0) {
+      if (bwriter->error == 0) bwriter->error = ERANGE;
+      return;
+    }
+    ambencode_writer_int(bwriter, value);
+    break;
+  }
+}
 
-  int  fd;
-  int  bytes_read;
-  
-  fd = local_mkstemp(tmpfile);
-  if (fd == -1) return -1;
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static int encode_writer(struct bhandle *bhandle, char *buf, size_t len, size_t *used) {
 
-  do {
+  struct bwriter bwriter;
+  struct bobject *bobject;
 
-    int  to_write;
-    int  bytes_written;
-    char buf[1024];
-    char *ptr;
+  ambencode_writer_init(&bwriter, buf, len, 0);
 
-    do {
-      bytes_read = read(0, buf, 1024 * 1024);
-    } while ((bytes_read == -1) && (errno == EINTR));
+  for (bobject = BOBJECT_FIRST(bhandle); bobject; bobject = BOBJECT_NEXT(bhandle, bobject)) {
+    writer_tree(&bwriter, bhandle, bobject);
+  }
+
+  if (bwriter.error == ERANGE) {
+    errno = ERANGE;
+    return -1;
+  }
+
+  return ambencode_writer_finish(&bwriter, used);
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static int encode_dump(struct bhandle *bhandle, char *buf, size_t len, size_t *used) {
+
+  struct bsink sink;
+  struct bobject *bobject;
+
+  ambencode_sink_buffer(&sink, buf, len);
+
+  for (*used = 0, bobject = BOBJECT_FIRST(bhandle); bobject; bobject = BOBJECT_NEXT(bhandle, bobject)) {
+    *used += ambencode_dump_sink(bhandle, bobject, 0, &sink);
+  }
+
+  return ambencode_sink_flush(&sink);
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static int benchmark_encode(struct bhandle *bhandle, const char *name,
+			    int (*encode)(struct bhandle *, char *, size_t, size_t *)) {
+
+  /* Encode the decoded documents again repeatedly for at least a 
+   * second, as benchmark_decode() does for decoding. The encoding is the
+   * size of the buffer decoded, integers that do not fit an int64_t 
+   * cannot be written by a bwriter.
+   */
+  struct timespec start;
+  struct timespec end;
+  double elapsed = 0.0;
+  double best    = 0.0;
+  long   encodes = 0;
+  long   batch   = 1;
+  size_t used;
+  char *buf;
+
+  if ((buf = (char *)malloc(bhandle->len + 1)) == (char *)0) return -1;
+
+  if (encode(bhandle, buf, bhandle->len + 1, &used) != 0) {
+    fprintf(stdout, "%s not encoded: %s\n", name, strerror(errno));
+    free(buf);
+    return 0;
+  }
 
-    if (bytes_read == -1) goto error;
-    
-    to_write = bytes_read;
-    ptr      = buf;
+  while (elapsed < 1.0) {
 
-    while (to_write) {
-    
-      do {
-	bytes_written = write(fd, ptr, to_write);
-      } while ((bytes_written == -1) && (errno == EINTR));
+    double seconds;
+    long i;
 
-      if (bytes_written == -1) goto error;
-            
-      to_write -= bytes_written;
-      ptr      += bytes_written;      
-    } 
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (i=0; i<batch; i++) {
+      encode(bhandle, buf, bhandle->len + 1, &used);
+    }
 
-  } while (bytes_read);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    seconds = tstos(&end) - tstos(&start);
 
-  close(fd);
+    if ((encodes == 0) || ((seconds / batch) < best)) {
+      best = seconds / batch;
+    }
+    elapsed += seconds;
+    encodes += batch;
+
+    if (seconds < 0.001) batch *= 2;
+  }
+
+  free(buf);
+
+  fprintf(stdout, "%s Encodes:%ld Average seconds:%.9f Best seconds:%.9f Best MB/s:%.1f\n",
+	  name, encodes, elapsed / encodes, best, (used / best) / 1000000.0);
+  return 0;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static int benchmark_decode(struct mhandle *mhandle, const char *name,
+			    int (*decode)(struct bhandle *, char *, xbsize_t),
+			    int pool) {
+
+  struct bhandle bhandle;
+  struct timespec start;
+  struct timespec end;
+  double elapsed = 0.0;
+  double best    = 0.0;
+  long   decodes = 0;
+  long   batch   = 1;
+  poff_t count;
+
+  if ((pool == POOL_RESET) &&
+      (ambencode_alloc(&bhandle, (struct bobject *)0, BOBJECT_COUNT_GUESS(mhandle->len)) != 0)) return -1;
+
+  /* Decode repeatedly for at least a second, in batches large enough
+   * for the clock to time small documents. Report the average time and
+   * the time of the fastest batch, which is least affected by other 
+   * activity on the system.
+   */
+  while (elapsed < 1.0) {
+
+    double seconds;
+    long i;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (i=0; i<batch; i++) {
+      if ((pool == POOL_ALLOC) &&
+	  (ambencode_alloc(&bhandle, (struct bobject *)0, BOBJECT_COUNT_GUESS(mhandle->len)) != 0)) return -1;
+      if ((pool == POOL_COUNT) &&
+	  ((ambencode_count((struct bhandle *)0, mhandle->buf, mhandle->len, &count) != 0) ||
+	   (ambencode_alloc(&bhandle, (struct bobject *)0, count) != 0))) return -1;
+      if ((pool == POOL_MAPPED) &&
+	  (ambencode_alloc_mapped(&bhandle, BOBJECT_COUNT_GUESS(mhandle->len), AMBENCODE_HUGEPAGES) != 0)) return -1;
+      if (pool == POOL_RESET) ambencode_reset(&bhandle);
+      if (decode(&bhandle, mhandle->buf, mhandle->len) != 0) return -1;
+      if ((pool == POOL_ALLOC) || (pool == POOL_COUNT) || (pool == POOL_MAPPED)) ambencode_free(&bhandle);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    seconds = tstos(&end) - tstos(&start);
+
+    if ((decodes == 0) || ((seconds / batch) < best)) {
+      best = seconds / batch;
+    }
+    elapsed += seconds;
+    decodes += batch;
+
+    if (seconds < 0.001) batch *= 2;
+  }
+
+  if (pool == POOL_RESET) ambencode_free(&bhandle);
+
+  fprintf(stdout, "%s Decodes:%ld Average seconds:%.9f Best seconds:%.9f Best MB/s:%.1f\n",
+	  name, decodes, elapsed / decodes, best, (mhandle->len / best) / 1000000.0);
   return 0;
- error:  
-  close(fd);
-  return -1;
 }
 
 /* -------------------------------------------------------------------- */
@@ -138,8 +530,8 @@ int main(int argc, char **argv) {
   int dump = 0; 
   int pretty = 0;
   int benchmark = 0;
+  int validation = 0;
   char *query = (char *)0;
-  char tmpfile[] = "/tmp/ambencode.XXXXXX";
 
   
   if ((argc < 2) || (argc > 3)) {
@@ -147,12 +539,15 @@ int main(int argc, char **argv) {
     fprintf(stderr, "       %s filepath query\n", argv[0]);
     fprintf(stderr, "       %s filepath --dump\n", argv[0]);
     fprintf(stderr, "       %s filepath --dump-pretty\n", argv[0]);
+    fprintf(stderr, "       %s filepath --validate\n", argv[0]);
     fprintf(stderr, "\n");
     fprintf(stderr, "filepath        - Path to file or '-' to read from stdin\n");
     fprintf(stderr, "   query        - Path to BENCODE object to display\n");
-    fprintf(stderr, "  --benchmark   - Map file and fill buffer cache, time decoding\n");
+    fprintf(stderr, "                  eg. \"info.files[*].length\" or \"sum(info.files[*].length)\"\n");
+    fprintf(stderr, "  --benchmark   - Map file and fill buffer cache, time decoding and encoding\n");
     fprintf(stderr, "  --dump        - Output compact BENCODE representation of data\n");
     fprintf(stderr, "  --dump-pretty - Output pretty printed BENCODE representation of data\n");
+    fprintf(stderr, "  --validate    - Validate without decoding, time validation\n");
     return 1;
   }
 
@@ -165,20 +560,13 @@ int main(int argc, char **argv) {
       pretty = 1;
     } else if (strcmp(argv[2],"--benchmark") == 0) {
       benchmark = 1;
+    } else if (strcmp(argv[2],"--validate") == 0) {
+      validation = 1;
     } else {
       query = argv[2];
     }
   }
   
-  if (strcmp(filepath, "-") == 0) {
-    if (copy_stdin(tmpfile) == -1) {
-      fprintf(stderr, "Failed to copy stdin\n");
-      return 1;					  
-    }
-
-    filepath = tmpfile;
-  }
-
 #ifndef MAP_LOCKED
 #define MAP_LOCKED 0
 #endif
@@ -186,75 +574,203 @@ int main(int argc, char **argv) {
 #define MAP_POPULATE 0
 #endif
 
-  if (ambencode_file_map(&mhandle, filepath, MAP_LOCKED|MAP_POPULATE) == 0) {
+  /* Stdin is parsed as it is read, there is no mapped buffer
+   */
+  if (strcmp(filepath, "-") == 0) {
+    if (validation) {
+      fprintf(stderr, "--validate needs a file, stdin is decoded as it is read\n");
+      return 1;
+    }
+    mhandle.buf = (char *)0;
+    mhandle.len = FEED_CHUNK;
+  } else if (ambencode_file_map(&mhandle, filepath, MAP_LOCKED|MAP_POPULATE) != 0) {
+    fprintf(stderr, "Failed mapping file\n");
+    return 1;
+  }
 
-    if (ambencode_alloc(&bhandle, (struct bobject *)0, BOBJECT_COUNT_GUESS(mhandle.len)) == 0) {
+  if (validation) {
 
-      struct timespec start;
-      struct timespec end;
-      double elapsed;
+    struct berror error;
+    struct timespec start;
+    struct timespec end;
+    int rc;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    rc = ambencode_validate((struct bhandle *)0, mhandle.buf, mhandle.len, &error);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    if (rc == 0) {
+      fprintf(stdout, "BENCODE valid [file:%s size:%lu]\n", 
+	      filepath, (unsigned long)mhandle.len);
+      fprintf(stdout, "Ellapsed time seconds:%f\n", tstos(&end) - tstos(&start));
+    } else {
+      fprintf(stderr, "BENCODE invalid [offset:%lu error:%s]\n",
+	      (unsigned long)error.offset, ambencode_strerror(error.code));
+    }
+
+    ambencode_file_unmap(&mhandle);
+    return (rc == 0)?0:1;
+  }
+
+  /* Stdin and large files may grow the pool well beyond the guess, a 
+   * mapped pool grows without copying
+   */
+  if (ambencode_alloc_mapped(&bhandle, BOBJECT_COUNT_GUESS(mhandle.len), AMBENCODE_HUGEPAGES) == 0) {
+
+    struct timespec start;
+    struct timespec end;
+    double elapsed;
+    poff_t count;
+    int projected = 0;
+    int rc;
       
-      if (benchmark) {
+    if (benchmark) {
 	
-	mlockall(MCL_CURRENT|MCL_FUTURE);
+      mlockall(MCL_CURRENT|MCL_FUTURE);
 	
-	clock_gettime(CLOCK_MONOTONIC, &start);
-      }
+      clock_gettime(CLOCK_MONOTONIC, &start);
+    }
+
+    /* Queries decode only the values on their path
+     */
+    if ((mhandle.buf) && (query)) {
+      rc = project(&bhandle, mhandle.buf, mhandle.len, query, &projected);
+    } else if (mhandle.buf) {
+      rc = ambencode_decode(&bhandle, mhandle.buf, mhandle.len);
+    } else {
+      rc = feed_stdin(&bhandle);
+    }
       
-      if (ambencode_decode(&bhandle, mhandle.buf, mhandle.len) == 0) {
+    if (rc == 0) {
 	
-	fprintf(stdout, "BENCODE valid [file:%s size:%d bobject:%d p:%d]\n", 
-		filepath, 
-		bhandle.len,
-		bhandle.used,
-		bhandle.len/bhandle.used);
-
-	if (dump) {
-	  ambencode_dump_json(&bhandle, (struct bobject *)0, 0, (char *)0, 0);
-	} else if (pretty) {
-	  ambencode_dump_json(&bhandle, (struct bobject *)0, 1, (char *)0, 0);
-	} else if (benchmark) {
-
-	  clock_gettime(CLOCK_MONOTONIC, &end);
-	  elapsed = tstos(&end) - tstos(&start);
-	  fprintf(stdout, "Ellapsed time seconds:%f\n", elapsed);
-	  
-	} else if (query) {
-	  struct bobject *bobject = ambencode_query(&bhandle, BOBJECT_ROOT(&bhandle), query);
-	  if (bobject) {
-	    ambencode_dump(&bhandle, bobject, 1, (char *)0, 0);
-	  } else {
-	    fprintf(stderr, "'%s' not found\n", query);
-	    return 1;
-	  }
+      /* A projected pool holds only the values on the query's path
+       */
+      fprintf(stdout, "BENCODE valid [file:%s size:%d %sbobject:%d p:%d]\n", 
+	      filepath, 
+	      bhandle.len,
+	      (projected)?"projected ":"",
+	      bhandle.used,
+	      bhandle.len/bhandle.used);
+
+      if ((dump) || (pretty)) {
+
+	/* Through stdout so the output follows the line above
+	 */
+	struct bsink sink;
+
+	ambencode_sink_file(&sink, stdout);
+	ambencode_dump_json_sink(&bhandle, (struct bobject *)0, pretty, &sink);
+	ambencode_sink_flush(&sink);
+      } else if (benchmark) {
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	elapsed = tstos(&end) - tstos(&start);
+	fprintf(stdout, "Ellapsed time seconds:%f\n", elapsed);
+
+	/* Walks of the pool just decoded, build ambencode_soa to compare
+	 * the two pool layouts
+	 */
+	if ((mhandle.buf) &&
+	    ((benchmark_walk(&bhandle, "walk tree", WALK_TREE) != 0) ||
+	     (benchmark_walk(&bhandle, "walk scan", WALK_SCAN) != 0))) {
+	  fprintf(stderr, "Benchmark failed\n");
+	  return 1;
 	}
 
-      } else {
-	if (errno == ENOMEM) {
-	  fprintf(stderr, "Failed allocating memory\n");
-	} else {
-	  fprintf(stderr, "BENCODE invalid\n");
+	/* Encoding of the documents just decoded, by dumping the DOM or
+	 * by walking it into a bwriter
+	 */
+	if ((mhandle.buf) &&
+	    ((benchmark_encode(&bhandle, "ambencode_dump_sink", encode_dump) != 0) ||
+	     (benchmark_encode(&bhandle, "ambencode_writer", encode_writer) != 0))) {
+	  fprintf(stderr, "Benchmark failed\n");
+	  return 1;
+	}
+
+	/* The guessed pool is grown while decoding whenever the guess is
+	 * too small, the counted pool never is.
+	 */
+	if ((mhandle.buf) &&
+	    (ambencode_count((struct bhandle *)0, mhandle.buf, mhandle.len, &count) == 0)) {
+	  fprintf(stdout, "Pool bobjects guessed:%lu counted:%lu\n",
+		  (unsigned long)BOBJECT_COUNT_GUESS(mhandle.len), (unsigned long)count);
+	}
+
+	/* Stdin can only be decoded once
+	 */
+	if ((mhandle.buf) &&
+	    ((benchmark_decode(&mhandle, "ambencode_decode", 
+			       ambencode_decode, POOL_ALLOC) != 0) ||
+	     (benchmark_decode(&mhandle, "ambencode_count+decode", 
+			       ambencode_decode, POOL_COUNT) != 0) ||
+	     (benchmark_decode(&mhandle, "ambencode_decode+mapped", 
+			       ambencode_decode, POOL_MAPPED) != 0) ||
+	     (benchmark_decode(&mhandle, "ambencode_decode+reset", 
+			       ambencode_decode, POOL_RESET) != 0) ||
+	     (benchmark_decode(&mhandle, "ambencode_decode_tape", 
+			       tape, POOL_ALLOC) != 0) ||
+	     (benchmark_decode(&mhandle, "ambencode_validate", 
+			       validate, POOL_NONE) != 0))) {
+	  fprintf(stderr, "Benchmark failed\n");
+	  return 1;
+	}
+
+	/* Scaling of a stream of concatenated documents, or of a single
+	 * list or dictionary, decoded on 1 to N threads
+	 */
+	if (mhandle.buf) {
+
+	  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	  char name[64];
+
+	  for (parallel_threads=1; ; parallel_threads*=2) {
+
+	    int rc;
+
+	    if (parallel_threads > cpus) parallel_threads = (int)cpus;
+	    if (parallel_threads < 1) parallel_threads = 1;
+
+	    if (bhandle.documents > 1) {
+	      snprintf(name, sizeof(name), "ambencode_parallel_decode threads:%d", parallel_threads);
+	      rc = benchmark_decode(&mhandle, name, parallel, POOL_NONE);
+	    } else {
+	      snprintf(name, sizeof(name), "ambencode_parallel_document threads:%d", parallel_threads);
+	      rc = benchmark_decode(&mhandle, name, document, POOL_ALLOC);
+	    }
+
+	    if (rc != 0) {
+	      fprintf(stderr, "Benchmark failed\n");
+	      return 1;
+	    }
+
+	    if ((parallel_threads >= cpus) || (parallel_threads >= AMBENCODE_MAXTHREADS)) break;
+	  }
 	}
-	return 1;
+	  
+      } else if (query) {
+	fflush(stdout);
+	if (query_output(&bhandle, query) != 0) return 1;
       }
 
     } else {
-      fprintf(stderr, "BENCODE alloc failed\n");
+      if (errno == ENOMEM) {
+	fprintf(stderr, "Failed allocating memory\n");
+      } else {
+	fprintf(stderr, "BENCODE invalid\n");
+      }
       return 1;
     }
 
-    ambencode_file_unmap(&mhandle);
-
-    ambencode_free(&bhandle);
-
   } else {
-    fprintf(stderr, "Failed mapping file\n");
+    fprintf(stderr, "BENCODE alloc failed\n");
     return 1;
   }
 
-  if (filepath == tmpfile) {
-    unlink(tmpfile);
+  if (mhandle.buf) {
+    ambencode_file_unmap(&mhandle);
   }
 
+  ambencode_free(&bhandle);
+
   return 0;
 }
@@ -32,11 +32,15 @@ THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 /* -------------------------------------------------------------------- */
 
 extern struct bobject *bobject_allocate(struct bhandle *bhandle, poff_t count);
+extern void bfind_free(struct bhandle *bhandle);
+extern int bsymbol_release(struct bhandle *bhandle, poff_t key);
 
 /* -------------------------------------------------------------------- */
 /* -------------------------------------------------------------------- */
 
 static poff_t ambencode_strdup(struct bhandle *bhandle, char *ptr, bsize_t len);
+static void ambencode_adopt(struct bhandle *bhandle, struct bobject *object,
+			    struct bobject *bobject);
 
 /* -------------------------------------------------------------------- */
 /* -------------------------------------------------------------------- */
@@ -51,6 +55,20 @@ static poff_t ambencode_strdup(struct bhandle *bhandle, char *ptr, bsize_t len)
   return BOBJECT_OFFSET(bhandle, dptr);
 }
 
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static void ambencode_adopt(struct bhandle *bhandle, struct bobject *object,
+			    struct bobject *bobject) {
+
+  /* A bobject added to a container is held by it, one already held by 
+   * another keeps that parent as changes to it must still reach the 
+   * spans of the containers it was decoded in
+   */
+  if ((bhandle->span) && (BOBJECT_SPAN(bhandle, bobject)->parent == 0)) {
+    BOBJECT_SPAN(bhandle, bobject)->parent = BOBJECT_OFFSET(bhandle, object) + 1;
+  }
+}
+
 /* -------------------------------------------------------------------- */
 /* -------------------------------------------------------------------- */
 struct bobject *ambencode_string_new(struct bhandle *bhandle,
@@ -64,9 +82,11 @@ struct bobject *ambencode_string_new(struct bhandle *bhandle,
     struct bobject *bobject = bobject_allocate(bhandle, 1);
     if (!bobject) return (struct bobject *)0;
 
-    bobject->blen            = len | AMBENCODE_STRBUFMASK | (AMBENCODE_STRING << AMBENCODE_LENBITS);
-    bobject->next            = AMBENCODE_INVALID;
-    bobject->u.string.offset = offset;
+    bobject->blen                                = len | AMBENCODE_STRBUFMASK | (AMBENCODE_STRING << AMBENCODE_LENBITS);
+    BOBJECT_LINK(bhandle, bobject)               = AMBENCODE_INVALID;
+    BOBJECT_DATA(bhandle, bobject).string.offset = offset;
+
+    if (bhandle->span) BOBJECT_SPAN(bhandle, bobject)->parent = 0;
     return bobject;
   }
   
@@ -80,31 +100,42 @@ struct bobject *ambencode_dictionary_add(struct bhandle *bhandle,
 					 struct bobject *string,
 					 struct bobject *value) {
 
+  /* A preorder tape cannot be extended in place
+   */
+  if (bhandle->tape) return (struct bobject *)0;
+
   if (BOBJECT_TYPE(object) == AMBENCODE_DICTIONARY) {
+
+    if ((bhandle->symbol) && (ambencode_intern_key(bhandle, string) == 0)) {
+      return (struct bobject *)0;
+    }
     
-    string->next = BOBJECT_OFFSET(bhandle, value);
+    BOBJECT_LINK(bhandle, string) = BOBJECT_OFFSET(bhandle, value);
     
     if (DICTIONARY_COUNT(object) == 0) {
       
-      object->u.object.child = BOBJECT_OFFSET(bhandle, string);
+      BOBJECT_DATA(bhandle, object).object.child = BOBJECT_OFFSET(bhandle, string);
       
     } else {
       
       struct bobject *bobject;
-      poff_t next = object->u.object.child;
+      poff_t next = BOBJECT_DATA(bhandle, object).object.child;
       
       for (;;) {
 	
 	bobject = BOBJECT_AT(bhandle, next);
-	if (bobject->next == AMBENCODE_INVALID) break;
+	if (BOBJECT_LINK(bhandle, bobject) == AMBENCODE_INVALID) break;
 	
-	next = bobject->next;
+	next = BOBJECT_LINK(bhandle, bobject);
       }
       
-      bobject->next = BOBJECT_OFFSET(bhandle, string);
+      BOBJECT_LINK(bhandle, bobject) = BOBJECT_OFFSET(bhandle, string);
     }
     
     object->blen = (DICTIONARY_COUNT(object) + 2) | (AMBENCODE_DICTIONARY << AMBENCODE_LENBITS);
+    ambencode_adopt(bhandle, object, string);
+    ambencode_adopt(bhandle, object, value);
+    ambencode_touch(bhandle, object);
     return object;
   }
   
@@ -123,6 +154,8 @@ struct bobject *ambencode_dictionary_new(struct bhandle *bhandle, ...) {
 
   bsize_t count = 0;
   
+  if (bhandle->tape) return (struct bobject *)0;
+
   va_start(ap, bhandle);
 
   for(;;) {
@@ -136,22 +169,27 @@ struct bobject *ambencode_dictionary_new(struct bhandle *bhandle, ...) {
       break;
     }
 
+    if ((bhandle->symbol) && (ambencode_intern_key(bhandle, string) == 0)) {
+      va_end(ap);
+      return (struct bobject *)0;
+    }
+
     count++;
     if (last == AMBENCODE_INVALID) {
       first = BOBJECT_OFFSET(bhandle, string);
       last  = first;
     } else {
       bobject = BOBJECT_AT(bhandle, last);
-      bobject->next = BOBJECT_OFFSET(bhandle, string);
-      last = bobject->next;
+      BOBJECT_LINK(bhandle, bobject) = BOBJECT_OFFSET(bhandle, string);
+      last = BOBJECT_LINK(bhandle, bobject);
     }
 
     value = va_arg(ap, struct bobject *);
 
     count++;
     bobject = BOBJECT_AT(bhandle, last);
-    bobject->next = BOBJECT_OFFSET(bhandle, value);
-    last = bobject->next;
+    BOBJECT_LINK(bhandle, bobject) = BOBJECT_OFFSET(bhandle, value);
+    last = BOBJECT_LINK(bhandle, bobject);
   }
 
   va_end(ap);
@@ -159,9 +197,21 @@ struct bobject *ambencode_dictionary_new(struct bhandle *bhandle, ...) {
   object = bobject_allocate(bhandle, 1);
   if (!object) return (struct bobject *)0;
 
-  object->blen           = count | (AMBENCODE_DICTIONARY << AMBENCODE_LENBITS);
-  object->next           = AMBENCODE_INVALID;
-  object->u.object.child = first;
+  object->blen                               = count | (AMBENCODE_DICTIONARY << AMBENCODE_LENBITS);
+  BOBJECT_LINK(bhandle, object)              = AMBENCODE_INVALID;
+  BOBJECT_DATA(bhandle, object).object.child = first;
+
+  if (bhandle->span) {
+
+    struct bobject *bobject;
+
+    BOBJECT_SPAN(bhandle, object)->len    = 0;
+    BOBJECT_SPAN(bhandle, object)->parent = 0;
+
+    for (bobject = LIST_FIRST(bhandle, object); bobject; bobject = LIST_NEXT(bhandle, bobject)) {
+      ambencode_adopt(bhandle, object, bobject);
+    }
+  }
   return object;
 }
 
@@ -177,6 +227,8 @@ struct bobject *ambencode_list_new(struct bhandle *bhandle, ...) {
 
   bsize_t count = 0;
   
+  if (bhandle->tape) return (struct bobject *)0;
+
   va_start(ap, bhandle);
 
   for(;;) {
@@ -193,8 +245,8 @@ struct bobject *ambencode_list_new(struct bhandle *bhandle, ...) {
     } else {
       struct bobject *bobject = BOBJECT_AT(bhandle, last);
 
-      bobject->next = BOBJECT_OFFSET(bhandle, value);
-      last = bobject->next;
+      BOBJECT_LINK(bhandle, bobject) = BOBJECT_OFFSET(bhandle, value);
+      last = BOBJECT_LINK(bhandle, bobject);
     }
   }
   
@@ -203,9 +255,21 @@ struct bobject *ambencode_list_new(struct bhandle *bhandle, ...) {
   array = bobject_allocate(bhandle, 1);
   if (!array) return (struct bobject *)0;
 
-  array->blen           = count | (AMBENCODE_LIST << AMBENCODE_LENBITS);
-  array->next           = AMBENCODE_INVALID;
-  array->u.object.child = first;
+  array->blen                               = count | (AMBENCODE_LIST << AMBENCODE_LENBITS);
+  BOBJECT_LINK(bhandle, array)              = AMBENCODE_INVALID;
+  BOBJECT_DATA(bhandle, array).object.child = first;
+
+  if (bhandle->span) {
+
+    struct bobject *bobject;
+
+    BOBJECT_SPAN(bhandle, array)->len    = 0;
+    BOBJECT_SPAN(bhandle, array)->parent = 0;
+
+    for (bobject = LIST_FIRST(bhandle, array); bobject; bobject = LIST_NEXT(bhandle, bobject)) {
+      ambencode_adopt(bhandle, array, bobject);
+    }
+  }
   return array;
 }
 
@@ -215,29 +279,33 @@ struct bobject *ambencode_list_add(struct bhandle *bhandle,
 				    struct bobject *array,
 				    struct bobject *value) {
   
+  if (bhandle->tape) return (struct bobject *)0;
+
   if (BOBJECT_TYPE(array) == AMBENCODE_LIST) {
     
     if (LIST_COUNT(array) == 0) {
       
-      array->u.object.child = BOBJECT_OFFSET(bhandle, value);
+      BOBJECT_DATA(bhandle, array).object.child = BOBJECT_OFFSET(bhandle, value);
       
     } else {
       
       struct bobject *bobject;
-      poff_t next = array->u.object.child;
+      poff_t next = BOBJECT_DATA(bhandle, array).object.child;
       
       for (;;) {
 	
 	bobject = BOBJECT_AT(bhandle, next);
-	if (bobject->next == AMBENCODE_INVALID) break;
+	if (BOBJECT_LINK(bhandle, bobject) == AMBENCODE_INVALID) break;
 	
-	next = bobject->next;
+	next = BOBJECT_LINK(bhandle, bobject);
       }
       
-      bobject->next = BOBJECT_OFFSET(bhandle, value);
+      BOBJECT_LINK(bhandle, bobject) = BOBJECT_OFFSET(bhandle, value);
     }
     
     array->blen = (LIST_COUNT(array) + 1) | (AMBENCODE_LIST << AMBENCODE_LENBITS);
+    ambencode_adopt(bhandle, array, value);
+    ambencode_touch(bhandle, array);
     return array;
   }
 
@@ -245,6 +313,60 @@ struct bobject *ambencode_list_add(struct bhandle *bhandle,
 }
 
 
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+struct bobject *ambencode_replace(struct bhandle *bhandle,
+				  struct bobject *old,
+				  struct bobject *new) {
+
+  /* Copy new over old keeping old's place amongst it's siblings, with 
+   * either pool layout. Old keeps it's parent but not new's span, the 
+   * members it now shares with new lead changes to them only to new.
+   * A string replaced may be a key and a dictionary replaced may have
+   * been indexed, key indexes are dropped rather than left stale and a
+   * string is interned again where keys are interned.
+   */
+  poff_t offset = BOBJECT_OFFSET(bhandle, old);
+  poff_t with   = BOBJECT_OFFSET(bhandle, new);
+  poff_t next   = BOBJECT_LINK(bhandle, old);
+
+  if (bhandle->tape) return (struct bobject *)0;
+
+  if ((bhandle->symbol) && (BOBJECT_TYPE(old) == AMBENCODE_STRING)) {
+
+    if (bsymbol_release(bhandle, offset) != 0) return (struct bobject *)0;
+
+    old = BOBJECT_AT(bhandle, offset);
+    new = BOBJECT_AT(bhandle, with);
+
+    if ((BOBJECT_TYPE(new) == AMBENCODE_STRING) && 
+	(ambencode_intern_key(bhandle, new) == 0)) {
+      return (struct bobject *)0;
+    }
+  }
+
+  ambencode_touch(bhandle, old);
+
+  if ((bhandle->find) && 
+      ((BOBJECT_TYPE(old) == AMBENCODE_STRING) || (BOBJECT_TYPE(old) == AMBENCODE_DICTIONARY))) {
+    bfind_free(bhandle);
+  }
+
+  old->blen                     = new->blen;
+  BOBJECT_DATA(bhandle, old)    = BOBJECT_DATA(bhandle, new);
+  BOBJECT_LINK(bhandle, old)    = next;
+
+  if (bhandle->integer) BOBJECT_INT64(bhandle, old) = BOBJECT_INT64(bhandle, new);
+  if (bhandle->span) BOBJECT_SPAN(bhandle, old)->len = 0;
+
+  if ((bhandle->symbol) && (BOBJECT_TYPE(old) == AMBENCODE_STRING)) {
+    BOBJECT_SYMBOL(bhandle, old) = BOBJECT_SYMBOL(bhandle, new);
+  }
+
+  return old;
+}
+
+#ifndef AMBENCODE_SOA
 /* -------------------------------------------------------------------- */
 /* -------------------------------------------------------------------- */
 struct bobject *ambencode_update(struct bobject *old,
@@ -256,6 +378,7 @@ struct bobject *ambencode_update(struct bobject *old,
 
   return (struct bobject *)old;
 }
+#endif
 
 /* -------------------------------------------------------------------- */
 /* -------------------------------------------------------------------- */
@@ -46,8 +46,34 @@ struct bobject *ambencode_list_new(struct bhandle *bhandle, ...);
 struct bobject *ambencode_list_add(struct bhandle *bhandle,
 				    struct bobject *array,
 				    struct bobject *value);
+
+/* Summary: Replace a bobject of a DOM, such as the value of a key, with
+ *          another keeping it's place amongst it's siblings. Unlike 
+ *          ambencode_update() this works with either pool layout and 
+ *          forgets the spans of the containers holding it, see 
+ *          ambencode_spans(). A key replaced where keys are interned 
+ *          is interned again as ambencode_dictionary_add() does, the 
+ *          pool may grow and move. Replacing a string or a dictionary
+ *          drops every key index, see ambencode_find_index().
+ * bhandle: This is a pointer to a bhandle holding a decoded DOM.
+ * old:     The bobject replaced.
+ * new:     The bobject it is replaced with.
+ *
+ * Return old, where it now is, or NULL if the pool is a preorder tape or
+ * a replaced key could not be interned.
+ */
+struct bobject *ambencode_replace(struct bhandle *bhandle,
+				  struct bobject *old,
+				  struct bobject *new);
+
+/* A bobject can only be copied whole when it is held in one array. It 
+ * does not see the bhandle, use ambencode_replace() where keys are 
+ * interned
+ */
+#ifndef AMBENCODE_SOA
 struct bobject *ambencode_update(struct bobject *old,
 				 struct bobject *new);
+#endif
 
 /* -------------------------------------------------------------------- */
 /* -------------------------------------------------------------------- */
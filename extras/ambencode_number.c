@@ -23,6 +23,8 @@ THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 
  * -------------------------------------------------------------------- */
 
+#include <errno.h>
+
 #include "ambencode.h"
 #include "extras/ambencode_number.h"
 
@@ -43,3 +45,64 @@ uint64_t ambencode_atou64(char *ptr, bsize_t len) {
 
 /* -------------------------------------------------------------------- */
 /* -------------------------------------------------------------------- */
+int ambencode_atou64_checked(char *ptr, bsize_t len, uint64_t *value) {
+
+  uint64_t result = 0;
+  
+  if ((len == 0) || (*ptr == '-')) goto range;
+
+  while (len--) {
+
+    const unsigned int digit = (unsigned char)(*ptr++ - '0');
+
+    if (result > (UINT64_MAX - digit) / 10) goto range;
+    result = (result * 10) + digit;
+  }
+  
+  *value = result;
+  return 0;
+
+ range:
+  errno = ERANGE;
+  return -1;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+int ambencode_atoi64(char *ptr, bsize_t len, int64_t *value) {
+
+  /* Accumulate negatively so that INT64_MIN can be held
+   */
+  const int negative = ((len) && (*ptr == '-'));
+  int64_t result = 0;
+
+  if (negative) {
+    ptr++;
+    len--;
+  }
+
+  if (len == 0) goto range;
+
+  while (len--) {
+
+    const int digit = *ptr++ - '0';
+
+    if (result < ((INT64_MIN + digit) / 10)) goto range;
+    result = (result * 10) - digit;
+  }
+
+  if (!negative) {
+    if (result == INT64_MIN) goto range;
+    result = -result;
+  }
+
+  *value = result;
+  return 0;
+
+ range:
+  errno = ERANGE;
+  return -1;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
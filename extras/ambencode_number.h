@@ -36,8 +36,41 @@ extern "C" {
 
 /* -------------------------------------------------------------------- */
 
+/* Summary: Convert the digits of a non-negative integer, such as the
+ *          BOBJECT_STRING_PTR() and BOBJECT_STRING_LEN() of a number.
+ *          ambencode_get_i64() in ambencode.c converts any integer.
+ *          The digits are not checked, there must be at least one and
+ *          the integer must fit in a uint64_t.
+ * ptr:     This is a pointer to the digits.
+ * len:     This is the number of digits.
+ *
+ * Return the value.
+ */
 uint64_t ambencode_atou64(char *ptr, bsize_t len);
 
+/* Summary: Convert the digits of a non-negative integer as 
+ *          ambencode_atou64() does, checking that they fit.
+ * ptr:     This is a pointer to the digits.
+ * len:     This is the number of digits.
+ * value:   On success this is set to the integer.
+ *
+ * Return 0 on success and !0 on failure.
+ * The value of errno will be set to ERANGE if there are no digits, the
+ * integer is negative or it does not fit in a uint64_t.
+ */
+int ambencode_atou64_checked(char *ptr, bsize_t len, uint64_t *value);
+
+/* Summary: Convert the digits of an integer with an optional sign.
+ * ptr:     This is a pointer to the digits.
+ * len:     This is the number of characters including any sign.
+ * value:   On success this is set to the integer.
+ *
+ * Return 0 on success and !0 on failure.
+ * The value of errno will be set to ERANGE if there are no digits or the
+ * integer does not fit in an int64_t.
+ */
+int ambencode_atoi64(char *ptr, bsize_t len, int64_t *value);
+
 /* -------------------------------------------------------------------- */
 /* -------------------------------------------------------------------- */
 
@@ -0,0 +1,781 @@
+/* -------------------------------------------------------------------- *
+
+Copyright 2019 Angelo Masci
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the 
+"Software"), to deal in the Software without restriction, including 
+without limitation the rights to use, copy, modify, merge, publish, 
+distribute, sublicense, and/or sell copies of the Software, and to permit 
+persons to whom the Software is furnished to do so, subject to the 
+following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF 
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. 
+IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT
+OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR 
+THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+ * -------------------------------------------------------------------- */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "ambencode.h"
+#include "extras/ambencode_parallel.h"
+
+/* -------------------------------------------------------------------- */
+
+extern struct bobject *bobject_allocate(struct bhandle *bhandle, poff_t count);
+
+/* -------------------------------------------------------------------- */
+
+#define PIECE_MIN       (64 * 1024) /* Smallest piece worth a thread */
+#define PROBE_VALUES    4           /* Values parsed to accept a split */
+#define PROBE_ANY       1           /* Probe values of any type */
+
+struct bprobe {
+
+  int            depth;           /* Depth within the probed value */
+  int            type;            /* Type every probed value must be, 0
+				   * for dictionary key value pairs or
+				   * PROBE_ANY */
+  int            started;         /* Values started */
+  int            values;          /* Values completed, -1 on a mismatch */
+};
+
+struct bsegment {
+
+  struct bpiece  *piece;          /* Piece decoded from the segment */
+  struct bhandle *bhandle;        /* Destination of the whole document */
+  poff_t         base;            /* Destination offset of the piece pool */
+  xbsize_t       offset;          /* Buffer offset of the piece */
+};
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+
+static int parallel_container(struct bhandle *bhandle, char *buf,
+			      xbsize_t start, xbsize_t end, int threads,
+			      int max_depth, poff_t *root);
+static int parallel_member(struct bhandle *bhandle, char *buf,
+			   xbsize_t start, xbsize_t end, int threads,
+			   int max_depth, poff_t *root);
+static int parallel_pieces(struct bparallel *bparallel, char *buf,
+			   xbsize_t start, xbsize_t end, int threads,
+			   int pairs, int max_depth);
+static int parallel_verify(struct bparallel *bparallel);
+static void parallel_run(void *args, size_t size, int count, 
+			 void *(*start)(void *));
+static xbsize_t parallel_split(char *buf, xbsize_t end, xbsize_t from,
+			       xbsize_t to, int pairs);
+static int parallel_large(char *buf, xbsize_t start, xbsize_t end);
+static int probe_value(struct bprobe *probe, int type);
+static int probe_dictionary(void *ctx);
+static int probe_list(void *ctx);
+static int probe_string(void *ctx, char *ptr, bsize_t len);
+static int probe_integer(void *ctx, char *ptr, bsize_t len);
+static int probe_end(void *ctx);
+static void *piece_thread(void *arg);
+static int piece_decode(struct bpiece *piece);
+static void *segment_thread(void *arg);
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+int ambencode_parallel_decode(struct bparallel *bparallel, char *buf,
+			      xbsize_t len, int threads) {
+
+  int rc;
+
+  if (len == 0) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  rc = parallel_pieces(bparallel, buf, 0, len, threads, 0, 
+		       AMBENCODE_MAXDEPTH);
+  if (rc == 0) {
+    parallel_run(bparallel->piece, sizeof(struct bpiece), bparallel->count,
+		 piece_thread);
+    rc = parallel_verify(bparallel);
+  }
+
+  if (rc == 0) return 0;
+
+  ambencode_parallel_free(bparallel);
+  errno = rc;
+  return -1;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+int ambencode_parallel_document(struct bhandle *bhandle, char *buf,
+				xbsize_t len, int threads) {
+
+  const poff_t used = bhandle->used;
+  poff_t root;
+
+  /* Only a single list or dictionary spanning the whole buffer is split,
+   * anything else or a failure to split is decoded sequentially so that
+   * the result and any error are always those of ambencode_decode().
+   * Keys are interned into a single table and spans are found from 
+   * those of earlier containers so both are decoded sequentially.
+   */
+  if ((threads < 2) || (len < 2 * PIECE_MIN) || (buf[len-1] != 'e') ||
+      ((buf[0] != 'd') && (buf[0] != 'l')) || (bhandle->symbol) ||
+      (bhandle->span)) goto sequential;
+
+  if (parallel_container(bhandle, buf, 0, len - 1, threads,
+			 bhandle->max_depth, &root) != 0) {
+    bhandle->used = used;
+    goto sequential;
+  }
+
+  bhandle->buf       = buf;
+  bhandle->len       = len;
+  bhandle->eptr      = &buf[len];
+  bhandle->depth     = 0;
+  bhandle->documents = 1;
+  bhandle->tape      = 0;
+  bhandle->first     = root;
+  bhandle->root      = root;
+  return 0;
+
+ sequential:
+  return ambencode_decode(bhandle, buf, len);
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+struct bobject *ambencode_parallel_first(struct bparallel *bparallel,
+					 struct bhandle **bhandle) {
+
+  int i;
+
+  for (i=0; i<bparallel->count; i++) {
+    if (bparallel->piece[i].bhandle.documents) {
+      *bhandle = &bparallel->piece[i].bhandle;
+      return BOBJECT_FIRST(*bhandle);
+    }
+  }
+
+  return (struct bobject *)0;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+struct bobject *ambencode_parallel_next(struct bparallel *bparallel,
+					struct bhandle **bhandle,
+					struct bobject *bobject) {
+
+  struct bobject *next = BOBJECT_NEXT(*bhandle, bobject);
+  int i;
+
+  if (next) return next;
+
+  /* The bhandle is the first member of it's piece
+   */
+  for (i=(int)((struct bpiece *)*bhandle - bparallel->piece) + 1; 
+       i<bparallel->count; i++) {
+    if (bparallel->piece[i].bhandle.documents) {
+      *bhandle = &bparallel->piece[i].bhandle;
+      return BOBJECT_FIRST(*bhandle);
+    }
+  }
+
+  return (struct bobject *)0;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+void ambencode_parallel_free(struct bparallel *bparallel) {
+
+  int i;
+
+  for (i=0; i<bparallel->count; i++) {
+    ambencode_free(&bparallel->piece[i].bhandle);
+  }
+
+  free(bparallel->piece);
+  bparallel->piece = (struct bpiece *)0;
+  bparallel->count = 0;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static int parallel_container(struct bhandle *bhandle, char *buf,
+			      xbsize_t start, xbsize_t end, int threads,
+			      int max_depth, poff_t *root) {
+
+  /* Append the bobjects of the list or dictionary from start to the 'e'
+   * at end to the pool, the offset of the container is set in root. 
+   * Return 0 on success or !0 if the container was not decoded in
+   * parallel, the pool may then hold partial bobjects.
+   */
+  struct bsegment segment[AMBENCODE_MAXTHREADS];
+  struct bparallel bparallel;
+  struct bobject *bobject;
+  struct bobject *last;
+  struct bpiece *piece;
+  const int type = (buf[start] == 'd')?AMBENCODE_DICTIONARY:AMBENCODE_LIST;
+  poff_t base;
+  uint64_t used;
+  uint64_t count;
+  int i;
+
+  if (max_depth < 2) return EINVAL;
+
+  /* A wrapper around a single large member, as in a scrape response, 
+   * is split within the member rather than between members
+   */
+  if (parallel_large(buf, start, end)) {
+    return parallel_member(bhandle, buf, start, end, threads, max_depth,
+			   root);
+  }
+
+  if (parallel_pieces(&bparallel, buf, start + 1, end, threads,
+		      (type == AMBENCODE_DICTIONARY), max_depth - 1) != 0) {
+    return ENOMEM;
+  }
+
+  if (bparallel.count < 2) {
+    ambencode_parallel_free(&bparallel);
+    return EINVAL;
+  }
+
+  parallel_run(bparallel.piece, sizeof(struct bpiece), bparallel.count,
+	       piece_thread);
+  if (parallel_verify(&bparallel) != 0) goto fail;
+
+  /* Each piece holds it's members in post order, laid end to end they
+   * are exactly the bobjects a sequential decode allocates before the
+   * container itself.
+   */
+  used  = 0;
+  count = 0;
+  for (i=0; i<bparallel.count; i++) {
+    used  += bparallel.piece[i].bhandle.used;
+    count += bparallel.piece[i].bhandle.documents;
+  }
+
+  if (count > AMBENCODE_LENMASK) goto fail;
+  if (used + 1 >= POFF_MAX) goto fail;
+
+  base = bhandle->used;
+  if (!bobject_allocate(bhandle, (poff_t)(used + 1))) goto fail;
+
+  for (i=0; i<bparallel.count; i++) {
+
+    piece = &bparallel.piece[i];
+
+    segment[i].piece   = piece;
+    segment[i].bhandle = bhandle;
+    segment[i].base    = base;
+    segment[i].offset  = (xbsize_t)(piece->buf - buf);
+
+    base += piece->bhandle.used;
+  }
+
+  parallel_run(segment, sizeof(struct bsegment), bparallel.count,
+	       segment_thread);
+
+  /* Link the last member of each piece to the first of the next and add
+   * the container
+   */
+  last    = (struct bobject *)0;
+  bobject = BOBJECT_AT(bhandle, base);
+
+  bobject->blen                               = (bsize_t)count | (type << AMBENCODE_LENBITS);
+  BOBJECT_LINK(bhandle, bobject)              = AMBENCODE_INVALID;
+  BOBJECT_DATA(bhandle, bobject).object.child = AMBENCODE_INVALID;
+
+  for (i=0; i<bparallel.count; i++) {
+
+    piece = &bparallel.piece[i];
+    if (piece->bhandle.documents == 0) continue;
+
+    if (last) {
+      BOBJECT_LINK(bhandle, last) = segment[i].base + piece->bhandle.first;
+    } else {
+      BOBJECT_DATA(bhandle, bobject).object.child = segment[i].base + piece->bhandle.first;
+    }
+    last = BOBJECT_AT(bhandle, segment[i].base + piece->bhandle.root);
+  }
+
+  ambencode_parallel_free(&bparallel);
+
+  *root = base;
+  return 0;
+
+ fail:
+  ambencode_parallel_free(&bparallel);
+  return EINVAL;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static int parallel_member(struct bhandle *bhandle, char *buf,
+			   xbsize_t start, xbsize_t end, int threads,
+			   int max_depth, poff_t *root) {
+
+  /* Decode a container whose only member, or only key and value, is a
+   * list or dictionary that ends at end - 1 by splitting that member.
+   * Return 0 on success or !0 if it is not such a container.
+   */
+  struct bsegment segment;
+  struct bpiece key;
+  struct bobject *bobject;
+  const int type = (buf[start] == 'd')?AMBENCODE_DICTIONARY:AMBENCODE_LIST;
+  xbsize_t member = start + 1;
+  poff_t base = AMBENCODE_INVALID;
+  poff_t child;
+  int rc;
+
+  if (buf[end - 1] != 'e') return EINVAL;
+
+  if (type == AMBENCODE_DICTIONARY) {
+
+    /* The length prefix is only used to find the member, the key itself
+     * is validated when it is decoded.
+     */
+    xbsize_t length = 0;
+
+    while ((member < end) && (buf[member] >= '0') && (buf[member] <= '9')) {
+      if (length > (XBOFF_MAX / 10) - 1) return EINVAL;
+      length = (length * 10) + (buf[member++] - '0');
+    }
+
+    if ((member >= end) || (buf[member] != ':')) return EINVAL;
+    if (length >= end - member) return EINVAL;
+    member += length + 1;
+  }
+
+  if ((member >= end - 1) || ((buf[member] != 'd') && (buf[member] != 'l'))) {
+    return EINVAL;
+  }
+
+  /* Bobjects are allocated in the order a sequential decode allocates
+   * them, the key, the member then the container.
+   */
+  if (type == AMBENCODE_DICTIONARY) {
+
+    if (ambencode_alloc(&key.bhandle, (struct bobject *)0, 2) != 0) return ENOMEM;
+
+    key.buf = &buf[start + 1];
+    key.len = member - (start + 1);
+
+    if ((ambencode_decode(&key.bhandle, key.buf, key.len) != 0) ||
+	(key.bhandle.used != 1) ||
+	(BOBJECT_TYPE(BOBJECT_ROOT(&key.bhandle)) != AMBENCODE_STRING)) {
+      ambencode_free(&key.bhandle);
+      return EINVAL;
+    }
+
+    base = bhandle->used;
+    if (!bobject_allocate(bhandle, 1)) {
+      ambencode_free(&key.bhandle);
+      return ENOMEM;
+    }
+
+    segment.piece   = &key;
+    segment.bhandle = bhandle;
+    segment.base    = base;
+    segment.offset  = start + 1;
+    segment_thread(&segment);
+
+    ambencode_free(&key.bhandle);
+  }
+
+  rc = parallel_container(bhandle, buf, member, end - 1, threads,
+			  max_depth - 1, &child);
+  if (rc != 0) return rc;
+
+  bobject = bobject_allocate(bhandle, 1);
+  if (!bobject) return ENOMEM;
+
+  BOBJECT_LINK(bhandle, bobject) = AMBENCODE_INVALID;
+
+  if (type == AMBENCODE_DICTIONARY) {
+    bobject->blen                               = 2 | (type << AMBENCODE_LENBITS);
+    BOBJECT_DATA(bhandle, bobject).object.child = base;
+    BOBJECT_LINK(bhandle, BOBJECT_AT(bhandle, base)) = child;
+  } else {
+    bobject->blen                               = 1 | (type << AMBENCODE_LENBITS);
+    BOBJECT_DATA(bhandle, bobject).object.child = child;
+  }
+
+  *root = BOBJECT_OFFSET(bhandle, bobject);
+  return 0;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static int parallel_pieces(struct bparallel *bparallel, char *buf,
+			   xbsize_t start, xbsize_t end, int threads,
+			   int pairs, int max_depth) {
+
+  /* Split start to end near equal fractions into at most threads pieces 
+   * each holding a sequence of values, a fraction with no split point
+   * within it is left to the previous piece.
+   */
+  struct bpiece *piece;
+  xbsize_t split;
+  const xbsize_t origin = start;
+  const xbsize_t len    = end - start;
+  int count;
+  int i;
+
+  if (threads > AMBENCODE_MAXTHREADS) threads = AMBENCODE_MAXTHREADS;
+  if (threads < 1) threads = 1;
+
+  count = (int)(len / PIECE_MIN);
+  if (count > threads) count = threads;
+  if (count < 1) count = 1;
+
+  bparallel->count = 0;
+  bparallel->piece = (struct bpiece *)malloc((size_t)count * sizeof(struct bpiece));
+  if (!bparallel->piece) return ENOMEM;
+
+  for (i=0; start < end; i++) {
+
+    split = end;
+    if (i + 1 < count) {
+      split = parallel_split(buf, end,
+			     origin + (xbsize_t)(((uint64_t)len * (i + 1)) / count),
+			     origin + (xbsize_t)(((uint64_t)len * (i + 2)) / count),
+			     pairs);
+      if (split <= start) continue;
+    }
+
+    piece = &bparallel->piece[bparallel->count];
+    if (ambencode_alloc(&piece->bhandle, (struct bobject *)0, 
+			BOBJECT_COUNT_GUESS(split - start)) != 0) goto fail;
+
+    bparallel->count++;
+    if (ambencode_maxdepth(&piece->bhandle, max_depth) != 0) goto fail;
+
+    piece->buf   = &buf[start];
+    piece->len   = split - start;
+    piece->rc    = 0;
+    piece->pairs = pairs;
+
+    start = split;
+  }
+
+  return 0;
+
+ fail:
+  ambencode_parallel_free(bparallel);
+  return ENOMEM;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static int parallel_verify(struct bparallel *bparallel) {
+
+  /* Each piece begins at a boundary when the piece before it decoded
+   * successfully. A piece that failed ended part way through a value, 
+   * it is decoded again together with the piece following it until it
+   * succeeds or the end of the buffer is reached.
+   */
+  struct bpiece *piece;
+  int merged;
+  int i;
+
+  for (i=0; i<bparallel->count; i++) {
+
+    piece = &bparallel->piece[i];
+    if (piece->rc == 0) continue;
+
+    for (merged=i+1; (piece->rc == EINVAL) && (merged < bparallel->count); merged++) {
+
+      struct bpiece *next = &bparallel->piece[merged];
+
+      piece->len += next->len;
+      next->buf  += next->len;
+      next->len   = 0;
+      ambencode_reset(&next->bhandle);
+
+      ambencode_reset(&piece->bhandle);
+      piece->rc = piece_decode(piece);
+      i = merged;
+    }
+
+    if (piece->rc != 0) return piece->rc;
+  }
+
+  return 0;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static void parallel_run(void *args, size_t size, int count, 
+			 void *(*start)(void *)) {
+
+  /* Call start for count arguments of size bytes, the caller runs the
+   * first and any whose thread could not be created.
+   */
+  pthread_t thread[AMBENCODE_MAXTHREADS];
+  int       started[AMBENCODE_MAXTHREADS];
+  int i;
+
+  for (i=1; i<count; i++) {
+    started[i] = (pthread_create(&thread[i], (pthread_attr_t *)0, start,
+				 (char *)args + (i * size)) == 0);
+  }
+
+  if (count) start(args);
+
+  for (i=1; i<count; i++) {
+    if (started[i]) {
+      pthread_join(thread[i], (void **)0);
+    } else {
+      start((char *)args + (i * size));
+    }
+  }
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static xbsize_t parallel_split(char *buf, xbsize_t end, xbsize_t from,
+			       xbsize_t to, int pairs) {
+
+  /* Return the offset of the first likely boundary between from and to,
+   * otherwise return 0. A boundary is a list or dictionary followed by
+   * PROBE_VALUES valid values of the same type or a dictionary key
+   * followed by PROBE_VALUES key value pairs, or by the remainder of 
+   * the buffer up to end. Such an offset is very likely, but not 
+   * certain, to be a boundary. Only containers are considered for 
+   * sequences as the keys and values of a dictionary would otherwise 
+   * often be accepted.
+   */
+  static const struct bevents events = { 
+    probe_dictionary, 0, probe_string, probe_integer, probe_list, probe_end 
+  };
+  struct bprobe probe;
+  int rc;
+
+  for (; from < to; from++) {
+
+    if (pairs) {
+      if ((buf[from] < '0') || (buf[from] > '9')) continue;
+      probe.type = 0;
+    } else {
+      if ((buf[from] != 'd') && (buf[from] != 'l')) continue;
+      probe.type = buf[from];
+    }
+
+    probe.depth   = 0;
+    probe.started = 0;
+    probe.values  = 0;
+
+    rc = ambencode_parse_events((struct bhandle *)0, &buf[from], 
+				end - from, &events, &probe);
+    if (probe.values == -1) continue;
+    if (rc == 0) {
+      if ((!pairs) || ((probe.values & 1) == 0)) return from;
+    } else if (probe.values == PROBE_VALUES * ((pairs)?2:1)) {
+      return from;
+    }
+  }
+
+  return 0;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static int parallel_large(char *buf, xbsize_t start, xbsize_t end) {
+
+  /* Return !0 if the first member of the container from start to end, 
+   * or the first key and value of a dictionary, is not complete within
+   * the first PIECE_MIN bytes.
+   */
+  static const struct bevents events = { 
+    probe_dictionary, 0, probe_string, probe_integer, probe_list, probe_end 
+  };
+  struct bprobe probe;
+  xbsize_t len = end - (start + 1);
+
+  if (len > PIECE_MIN) len = PIECE_MIN;
+
+  probe.depth   = 0;
+  probe.type    = (buf[start] == 'd')?0:PROBE_ANY;
+  probe.started = 0;
+  probe.values  = 0;
+
+  ambencode_parse_events((struct bhandle *)0, &buf[start + 1], len, 
+			 &events, &probe);
+
+  return (probe.values != -1) && (probe.values < ((probe.type)?1:2));
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static int probe_value(struct bprobe *probe, int type) {
+
+  /* A value is starting outside of any container
+   */
+  if (probe->type == PROBE_ANY) {
+    /* Any value is accepted */
+  } else if (probe->type) {
+    if (type != probe->type) goto mismatch;
+  } else {
+    if (((probe->started & 1) == 0) && (type != 's')) goto mismatch;
+  }
+
+  probe->started++;
+  return 0;
+
+ mismatch:
+  probe->values = -1;
+  return 1;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static int probe_dictionary(void *ctx) {
+
+  struct bprobe *probe = (struct bprobe *)ctx;
+
+  if (probe->depth++) return 0;
+  return probe_value(probe, 'd');
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static int probe_list(void *ctx) {
+
+  struct bprobe *probe = (struct bprobe *)ctx;
+
+  if (probe->depth++) return 0;
+  return probe_value(probe, 'l');
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static int probe_string(void *ctx, char *ptr, bsize_t len) {
+
+  struct bprobe *probe = (struct bprobe *)ctx;
+
+  (void)ptr;
+  (void)len;
+
+  if (probe->depth) return 0;
+  if (probe_value(probe, 's')) return 1;
+
+  return (++probe->values == PROBE_VALUES * ((probe->type)?1:2));
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static int probe_integer(void *ctx, char *ptr, bsize_t len) {
+
+  struct bprobe *probe = (struct bprobe *)ctx;
+
+  (void)ptr;
+  (void)len;
+
+  if (probe->depth) return 0;
+  if (probe_value(probe, 'i')) return 1;
+
+  return (++probe->values == PROBE_VALUES * ((probe->type)?1:2));
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static int probe_end(void *ctx) {
+
+  struct bprobe *probe = (struct bprobe *)ctx;
+
+  if (--probe->depth) return 0;
+
+  return (++probe->values == PROBE_VALUES * ((probe->type)?1:2));
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static void *piece_thread(void *arg) {
+
+  struct bpiece *piece = (struct bpiece *)arg;
+
+  piece->rc = piece_decode(piece);
+  return (void *)0;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static int piece_decode(struct bpiece *piece) {
+
+  /* Decode a piece as a sequence of values, the members of a dictionary
+   * must also be string keys each followed by a value.
+   */
+  struct bhandle *bhandle = &piece->bhandle;
+  struct bobject *bobject;
+  poff_t i;
+
+  if (ambencode_decode(bhandle, piece->buf, piece->len) != 0) return errno;
+  if (!piece->pairs) return 0;
+
+  if (bhandle->documents & 1) return EINVAL;
+
+  for (i=0, bobject=BOBJECT_FIRST(bhandle); bobject; 
+       i++, bobject=BOBJECT_NEXT(bhandle, bobject)) {
+    if (((i & 1) == 0) && (BOBJECT_TYPE(bobject) != AMBENCODE_STRING)) {
+      return EINVAL;
+    }
+  }
+
+  return 0;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static void *segment_thread(void *arg) {
+
+  /* Copy the pool of a piece into the destination, offsetting pool 
+   * offsets by the piece's position in the destination pool and string
+   * offsets by the piece's position in the buffer. Integers are 
+   * converted here when the destination keeps them.
+   */
+  struct bsegment *segment = (struct bsegment *)arg;
+  struct bhandle *from  = &segment->piece->bhandle;
+  struct bhandle *to    = segment->bhandle;
+  const poff_t used     = from->used;
+  const poff_t base     = segment->base;
+  const xbsize_t offset = segment->offset;
+  struct bobject *src;
+  struct bobject *dst;
+  poff_t i;
+
+  for (i=0; i<used; i++) {
+
+    src = BOBJECT_AT(from, i);
+    dst = BOBJECT_AT(to, base + i);
+
+    dst->blen             = src->blen;
+    BOBJECT_DATA(to, dst) = BOBJECT_DATA(from, src);
+    BOBJECT_LINK(to, dst) = BOBJECT_LINK(from, src);
+
+    if ((to->integer) && (BOBJECT_TYPE(dst) == AMBENCODE_NUMBER) &&
+	(ambencode_get_i64(from, src, &BOBJECT_INT64(to, dst)) != 0)) {
+      BOBJECT_INT64(to, dst) = AMBENCODE_BIGINTEGER;
+    }
+
+    if (BOBJECT_TYPE(dst) >= AMBENCODE_STRING) {
+      BOBJECT_DATA(to, dst).string.offset += offset;
+    } else if (LIST_COUNT(dst)) {
+      BOBJECT_DATA(to, dst).object.child  += base;
+    }
+
+    if (BOBJECT_LINK(to, dst) != AMBENCODE_INVALID) BOBJECT_LINK(to, dst) += base;
+  }
+
+  return (void *)0;
+}
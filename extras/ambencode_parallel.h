@@ -0,0 +1,135 @@
+/* -------------------------------------------------------------------- *
+
+Copyright 2019 Angelo Masci
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the 
+"Software"), to deal in the Software without restriction, including 
+without limitation the rights to use, copy, modify, merge, publish, 
+distribute, sublicense, and/or sell copies of the Software, and to permit 
+persons to whom the Software is furnished to do so, subject to the 
+following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF 
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. 
+IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT
+OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR 
+THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+ * -------------------------------------------------------------------- */
+
+#ifndef _AMBENCODE_PARALLEL_H_
+#define _AMBENCODE_PARALLEL_H_
+
+#include "ambencode.h"
+
+/* -------------------------------------------------------------------- */
+
+#define AMBENCODE_MAXTHREADS 64   /* Most threads a buffer is decoded on */
+
+struct bpiece {
+
+  struct bhandle bhandle;         /* Documents decoded from this piece */
+  char           *buf;            /* Start of the piece */
+  xbsize_t       len;             /* Length of the piece */
+  int            rc;              /* 0 or errno from decoding the piece */
+  int            pairs;           /* Piece holds dictionary members */
+};
+
+struct bparallel {
+
+  struct bpiece  *piece;          /* Pieces in buffer order */
+  int            count;           /* Count of pieces */
+};
+
+/* -------------------------------------------------------------------- */
+
+#ifdef __cplusplus
+extern "C" {  
+#endif
+
+/* -------------------------------------------------------------------- */
+
+/* Summary: Decode a buffer holding a stream of concatenated BENCODE 
+ *          documents on up to threads threads. The buffer is split into
+ *          pieces at document boundaries, each piece is decoded into
+ *          it's own bhandle and the pieces are kept in buffer order.
+ *          Boundaries are found by speculatively parsing a few documents
+ *          after each split point and are confirmed by the piece before 
+ *          decoding exactly up to them, a piece whose end was wrong is
+ *          decoded again together with the next piece. A stream of one
+ *          large document is therefore decoded on a single thread.
+ * bparallel: This is a pointer to an uninitialised bparallel structure.
+ *          On success a subsequent call to ambencode_parallel_free() must
+ *          be made to release any resources held.
+ * buf:     This is a pointer to a buffer holding BENCODE data to be parsed.
+ *          The contents of this buffer MUST not be freed or changed while
+ *          the pieces exist.
+ * len:     This is the length of the BENCODE buffer in bytes.
+ * threads: This is the most threads to decode on, including the caller.
+ *
+ * Return 0 on success and !0 on failure.
+ * The value of errno will be set to EINVAL if an error ocurred parsing
+ * the BENCODE buffer. ENOMEM indicates a problem allocating memory.
+ * Pieces whose thread could not be created are decoded by the caller.
+ */
+int ambencode_parallel_decode(struct bparallel *bparallel, char *buf,
+			      xbsize_t len, int threads);
+
+/* Summary: Decode a buffer holding a single large list or dictionary on
+ *          up to threads threads, producing exactly the same bobject
+ *          pool as ambencode_decode(). The members of the container are
+ *          split into pieces in the same way as ambencode_parallel_decode()
+ *          splits documents, dictionaries only at a key. Each piece is
+ *          decoded into it's own pool, the pools are then copied end to
+ *          end into the bhandle's pool in parallel and linked. Buffers 
+ *          that are not a single container, members that could not be
+ *          split and invalid buffers are decoded by ambencode_decode().
+ *          Lists of strings or integers are never split.
+ * bhandle: This is a pointer to an initialised bhandle structure.
+ * buf:     This is a pointer to a buffer holding BENCODE data to be parsed.
+ *          The contents of this buffer MUST not be freed or changed while
+ *          the ambencode context exists.
+ * len:     This is the length of the BENCODE buffer in bytes.
+ * threads: This is the most threads to decode on, including the caller.
+ *
+ * Return 0 on success and !0 on failure, errno is set as by 
+ * ambencode_decode()
+ */
+int ambencode_parallel_document(struct bhandle *bhandle, char *buf,
+				xbsize_t len, int threads);
+
+/* Summary: Iterate every document decoded by ambencode_parallel_decode()
+ *          in the order they appear in the buffer.
+ * bparallel: This is a pointer to a decoded bparallel structure.
+ * bhandle: This is set to the bhandle holding the document returned, it
+ *          is needed to access the document with the bobject macros.
+ * bobject: This is the document previously returned.
+ *
+ * Return the first or next document or (struct bobject *)0 if there are
+ * no more.
+ */
+struct bobject *ambencode_parallel_first(struct bparallel *bparallel,
+					 struct bhandle **bhandle);
+struct bobject *ambencode_parallel_next(struct bparallel *bparallel,
+					struct bhandle **bhandle,
+					struct bobject *bobject);
+
+/* Summary: Release any resources held by a decoded bparallel structure.
+ * bparallel: This is a pointer to a decoded bparallel structure.
+ */
+void ambencode_parallel_free(struct bparallel *bparallel);
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -23,6 +23,11 @@ THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 
  * -------------------------------------------------------------------- */
 
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+
 #include "ambencode.h"
 #include "extras/ambencode_query.h"
 #include "extras/ambencode_util.h"
@@ -30,8 +35,48 @@ THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 /* -------------------------------------------------------------------- */
 /* -------------------------------------------------------------------- */
 
+#define QUERY_MATCHBITS 32        /* Steps from a dictionary matched in one
+				   * walk of it's keys, any more are found 
+				   * with ambencode_object_find() */
+
+#define QUERY_OPEN ((poff_t)-1)   /* End of a slice with no end given */
+
+#define QUERY_SYMBOLS 32          /* Steps whose symbols are resolved on 
+				   * the stack, larger programs allocate */
+
+struct qrun {
+
+  int            (*callback)(void *ctx, int path, struct bobject *bobject);
+  void           *ctx;            /* Passed to callback */
+  int            count;           /* Count of values matched */
+  int            stop;            /* callback returned !0 */
+  bsize_t        *symbol;         /* Symbol of each step when keys are
+				   * interned, or 0 */
+  bsize_t        symbols[QUERY_SYMBOLS];
+};
+
+struct qaggregate {
+
+  struct bhandle    *bhandle;     /* DOM the values are from */
+  struct baggregate *aggregates;  /* Aggregate of each path */
+};
+
 static char *query_index(char *ptr);
 static char *query_identifier(char *ptr);
+static char *query_number(char *ptr, poff_t *number);
+static char *query_slice(char *ptr, poff_t *index, poff_t *end);
+static int query_function(char *ptr, char **start, char **end);
+static int query_path(struct bquery *bquery, char *ptr, char *end, size_t *text);
+static int query_add(struct bquery *bquery, int parent, struct bstep *add);
+static void query_step(struct bhandle *bhandle, struct bquery *bquery, int step,
+		       struct bobject *bobject, struct qrun *run);
+static void query_dictionary(struct bhandle *bhandle, struct bquery *bquery, int step,
+			     struct bobject *bobject, struct qrun *run);
+static void query_list(struct bhandle *bhandle, struct bquery *bquery, int step,
+		       struct bobject *bobject, struct qrun *run);
+static int query_result(void *ctx, int path, struct bobject *bobject);
+static int query_aggregate(void *ctx, int path, struct bobject *bobject);
+static int query_select(void *ctx, int state, char *key, bsize_t len, bsize_t index);
 
 /* -------------------------------------------------------------------- */
 /* -------------------------------------------------------------------- */
@@ -143,3 +188,594 @@ struct bobject *ambencode_query(struct bhandle *bhandle,
 
 /* -------------------------------------------------------------------- */
 /* -------------------------------------------------------------------- */
+int ambencode_query_compile(struct bquery *bquery, char **paths, int count) {
+
+  size_t size = 0;
+  size_t text = 0;
+  int i;
+
+  memset(bquery, 0, sizeof(struct bquery));
+
+  /* Each step takes at least one character of it's path so the steps 
+   * and keys of every path can be allocated before they are parsed
+   */
+  for (i = 0; i < count; i++) size += strlen(paths[i]);
+
+  bquery->step     = (struct bstep *)calloc(size + 1, sizeof(struct bstep));
+  bquery->pathnext = (int *)calloc((count)?count:1, sizeof(int));
+  bquery->function = (int *)calloc((count)?count:1, sizeof(int));
+  bquery->text     = (char *)malloc((size)?size:1);
+  if ((!bquery->step) || (!bquery->pathnext) || 
+      (!bquery->function) || (!bquery->text)) {
+    errno = ENOMEM;
+    goto fail;
+  }
+
+  bquery->steps = 1;
+  bquery->paths = count;
+
+  for (i = 0; i < count; i++) {
+
+    char *start = paths[i];
+    char *end = start + strlen(start);
+    int step;
+
+    bquery->function[i] = query_function(paths[i], &start, &end);
+
+    step = query_path(bquery, start, end, &text);
+    if (step < 0) {
+      errno = EINVAL;
+      goto fail;
+    }
+
+    bquery->pathnext[i]     = bquery->step[step].path;
+    bquery->step[step].path = i + 1;
+  }
+
+  return 0;
+
+ fail:
+  ambencode_query_free(bquery);
+  return -1;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static int query_function(char *ptr, char **start, char **end) {
+
+  /* A path may be wrapped by an aggregate such as "sum(path)", return 
+   * it and the path it wraps
+   */
+  static const struct {
+    const char *name;
+    size_t     len;
+    int        function;
+  } functions[] = {
+    { "count(", 6, BQUERY_COUNT },
+    { "sum(",   4, BQUERY_SUM   },
+    { "min(",   4, BQUERY_MIN   },
+    { "max(",   4, BQUERY_MAX   }
+  };
+  size_t len = strlen(ptr);
+  size_t i;
+
+  if ((len == 0) || (ptr[len - 1] != ')')) return BQUERY_NONE;
+
+  for (i = 0; i < (sizeof(functions) / sizeof(functions[0])); i++) {
+    if ((len > functions[i].len) &&
+	(memcmp(ptr, functions[i].name, functions[i].len) == 0)) {
+
+      *start = ptr + functions[i].len;
+      *end   = ptr + len - 1;
+      return functions[i].function;
+    }
+  }
+
+  return BQUERY_NONE;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static int query_path(struct bquery *bquery, char *ptr, char *end, size_t *text) {
+
+  /* Parse a path as ambencode_query() does, adding it's steps below the 
+   * first step. A key of "*" steps to every value of a dictionary or 
+   * list and lists may also be sliced, "[*]" "[2:]" or "[:10]". Return
+   * the step the path ends at or -1 if it is not valid.
+   */
+  int step = 0;
+
+  if (ptr == end) goto fail;
+
+  for (;;) {
+
+    struct bstep add;
+    char *nptr;
+
+    memset(&add, 0, sizeof(struct bstep));
+
+    if ((nptr = query_index(ptr)) != ptr) {
+
+      add.type = BQUERY_INDEX;
+      query_number(ptr + 1, &add.index);
+    } else if ((nptr = query_slice(ptr, &add.index, &add.end)) != ptr) {
+
+      add.type = BQUERY_SLICE;
+    } else {
+
+      nptr = query_identifier(ptr);
+      if (nptr > end) nptr = end;
+      if (nptr == ptr) goto fail;
+
+      if (((nptr - ptr) == 1) && (*ptr == '*')) {
+	add.type = BQUERY_ANY;
+      } else {
+	add.type = BQUERY_KEY;
+	add.key  = *text;
+	add.len  = (bsize_t)(nptr - ptr);
+
+	memcpy(&bquery->text[*text], ptr, add.len);
+	*text += add.len;
+      }
+    }
+
+    step = query_add(bquery, step, &add);
+
+    ptr = nptr;
+    if (ptr == end) goto success;
+    if (ptr > end) goto fail;
+
+    if ((*ptr != '.') &&
+	(*ptr != '['))
+      goto fail;
+    
+    if (*ptr == '.') ptr++;      
+  }
+
+ success:
+  return step;
+ fail:
+  return -1;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static char *query_number(char *ptr, poff_t *number) {
+
+  /* Parse an index without leading zeros, return ptr if there is none
+   */
+  *number = 0;
+
+  if (*ptr == '0') return ptr + 1;
+
+  while ((*ptr >= '0') && (*ptr <= '9')) {
+    *number *= 10;
+    *number += *ptr - '0';
+    ptr++;
+  }
+
+  return ptr;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static char *query_slice(char *ptr, poff_t *index, poff_t *end) {
+
+  /* Parse "[*]" or "[start:end]" where either may be left out, return
+   * ptr if there is no slice
+   */
+  char *optr = ptr;
+  char *nptr;
+
+  if (*ptr++ != '[') goto fail;
+
+  *index = 0;
+  *end   = QUERY_OPEN;
+
+  if (*ptr == '*') {
+    ptr++;
+  } else {
+    nptr = query_number(ptr, index);
+    if (*nptr != ':') goto fail;
+
+    ptr  = nptr + 1;
+    nptr = query_number(ptr, end);
+    if (nptr == ptr) *end = QUERY_OPEN;
+    ptr  = nptr;
+  }
+
+  if (*ptr++ != ']') goto fail;
+  return ptr;
+
+ fail:
+  return optr;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static int query_add(struct bquery *bquery, int parent, struct bstep *add) {
+
+  /* Return the step from parent matching add, adding it if there is 
+   * none yet. Keys added for a step that already exists are left unused
+   * in text.
+   */
+  int *pstep;
+
+  for (pstep = &bquery->step[parent].child; *pstep; 
+       pstep = &bquery->step[*pstep].next) {
+
+    struct bstep *step = &bquery->step[*pstep];
+
+    if (step->type != add->type) continue;
+
+    switch (step->type) {
+    case BQUERY_KEY:
+      if ((step->len == add->len) &&
+	  (memcmp(&bquery->text[step->key], &bquery->text[add->key], add->len) == 0)) {
+	return *pstep;
+      }
+      break;
+    case BQUERY_INDEX:
+      if (step->index == add->index) return *pstep;
+      break;
+    case BQUERY_SLICE:
+      if ((step->index == add->index) && (step->end == add->end)) return *pstep;
+      break;
+    case BQUERY_ANY:
+      return *pstep;
+    }
+  }
+
+  *pstep                      = bquery->steps;
+  bquery->step[bquery->steps] = *add;
+  return bquery->steps++;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+int ambencode_query_each(struct bhandle *bhandle, struct bobject *bobject,
+			 struct bquery *bquery,
+			 int (*callback)(void *ctx, int path, struct bobject *bobject),
+			 void *ctx) {
+  struct qrun run;
+  int step;
+
+  run.callback = callback;
+  run.ctx      = ctx;
+  run.count    = 0;
+  run.stop     = 0;
+  run.symbol   = (bsize_t *)0;
+
+  /* Where the keys of bhandle are interned each key is resolved to it's
+   * symbol once for this call and keys are then compared by symbol, the
+   * bquery is not written so may be evaluated by several threads. Keys
+   * are compared as bytes if there is no memory for the symbols.
+   */
+  if (bhandle->symbol) {
+    run.symbol = (bquery->steps <= QUERY_SYMBOLS)?run.symbols:
+      (bsize_t *)malloc(bquery->steps * sizeof(bsize_t));
+  }
+
+  if (run.symbol) {
+    for (step = 1; step < bquery->steps; step++) {
+      run.symbol[step] = (bquery->step[step].type == BQUERY_KEY)?
+	ambencode_symbol(bhandle, &bquery->text[bquery->step[step].key], 
+			 bquery->step[step].len):0;
+    }
+  }
+
+  query_step(bhandle, bquery, 0, bobject, &run);
+
+  if (run.symbol != run.symbols) free(run.symbol);
+
+  return run.count;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+int ambencode_query_many(struct bhandle *bhandle, struct bobject *bobject,
+			 struct bquery *bquery, struct bobject **results) {
+
+  int found = 0;
+  int i;
+
+  for (i = 0; i < bquery->paths; i++) results[i] = (struct bobject *)0;
+
+  ambencode_query_each(bhandle, bobject, bquery, query_result, results);
+
+  for (i = 0; i < bquery->paths; i++) {
+    if (results[i]) found++;
+  }
+
+  return found;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static int query_result(void *ctx, int path, struct bobject *bobject) {
+
+  /* Keep the first value matched by each path
+   */
+  struct bobject **results = (struct bobject **)ctx;
+
+  if (!results[path]) results[path] = bobject;
+  return 0;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+int ambencode_query_aggregate(struct bhandle *bhandle, struct bobject *bobject,
+			      struct bquery *bquery, struct baggregate *aggregates) {
+  struct qaggregate qaggregate;
+
+  memset(aggregates, 0, bquery->paths * sizeof(struct baggregate));
+
+  qaggregate.bhandle    = bhandle;
+  qaggregate.aggregates = aggregates;
+
+  return ambencode_query_each(bhandle, bobject, bquery, query_aggregate, &qaggregate);
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static int query_aggregate(void *ctx, int path, struct bobject *bobject) {
+
+  /* Integers are aggregated as converted by ambencode_get_i64(), values
+   * that are not integers are only counted
+   */
+  struct qaggregate *qaggregate = (struct qaggregate *)ctx;
+  struct baggregate *aggregate = &qaggregate->aggregates[path];
+  int64_t value;
+
+  aggregate->count++;
+
+  if (BOBJECT_TYPE(bobject) != AMBENCODE_NUMBER) return 0;
+
+  if (ambencode_get_i64(qaggregate->bhandle, bobject, &value) != 0) {
+    aggregate->overflow = 1;
+    return 0;
+  }
+
+  if (aggregate->integers++ == 0) {
+    aggregate->min = value;
+    aggregate->max = value;
+  } else if (value < aggregate->min) {
+    aggregate->min = value;
+  } else if (value > aggregate->max) {
+    aggregate->max = value;
+  }
+
+  if (((value > 0) && (aggregate->sum > (INT64_MAX - value))) ||
+      ((value < 0) && (aggregate->sum < (INT64_MIN - value)))) {
+    aggregate->overflow = 1;
+  } else {
+    aggregate->sum += value;
+  }
+
+  return 0;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static void query_step(struct bhandle *bhandle, struct bquery *bquery, int step,
+		       struct bobject *bobject, struct qrun *run) {
+
+  /* bobject has been reached by step, report it for the paths that end
+   * here and take the steps that follow
+   */
+  int path;
+
+  for (path = bquery->step[step].path; (path) && (!run->stop); 
+       path = bquery->pathnext[path - 1]) {
+
+    run->count++;
+    if (run->callback(run->ctx, path - 1, bobject) != 0) run->stop = 1;
+  }
+
+  if ((!bquery->step[step].child) || (run->stop)) return;
+
+  switch (BOBJECT_TYPE(bobject)) {
+  case AMBENCODE_DICTIONARY:
+    query_dictionary(bhandle, bquery, step, bobject, run);
+    break;
+  case AMBENCODE_LIST:
+    query_list(bhandle, bquery, step, bobject, run);
+    break;
+  }
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static void query_dictionary(struct bhandle *bhandle, struct bquery *bquery, int step,
+			     struct bobject *bobject, struct qrun *run) {
+
+  /* Walk the keys once comparing each with the keys wanted, only the 
+   * first of any duplicate keys is used as by ambencode_object_find().
+   * Dictionaries with a key index are searched through it instead. 
+   * Every value is stepped to when "*" is wanted. Interned keys are 
+   * compared by symbol and a key that was never interned is in no 
+   * dictionary.
+   */
+  const int indexed = ((DICTIONARY_COUNT(bobject) >= AMBENCODE_FINDMIN * 2) &&
+		       ((bhandle->find) || (bhandle->findlazy)));
+  unsigned long wanted = 0;
+  struct bobject *key;
+  int any = 0;
+  int child;
+  int n;
+
+  for (child = bquery->step[step].child, n = 0; child; 
+       child = bquery->step[child].next, n++) {
+
+    if (bquery->step[child].type == BQUERY_ANY) any = 1;
+    if (bquery->step[child].type != BQUERY_KEY) continue;
+    if ((run->symbol) && (run->symbol[child] == 0)) continue;
+
+    if ((indexed) || (n >= QUERY_MATCHBITS)) {
+
+      struct bobject *value = ambencode_object_find(bhandle, bobject, 
+						    &bquery->text[bquery->step[child].key],
+						    bquery->step[child].len);
+      if (value) query_step(bhandle, bquery, child, value, run);
+      if (run->stop) return;
+    } else {
+      wanted |= 1UL << n;
+    }
+  }
+
+  for (key = DICTIONARY_FIRST_KEY(bhandle, bobject); (key) && ((wanted) || (any)); 
+       key = DICTIONARY_NEXT_KEY(bhandle, key)) {
+
+    const char *ptr = BOBJECT_STRING_PTR(bhandle, key);
+    const bsize_t len = BOBJECT_STRING_LEN(key);
+    struct bobject *value = BOBJECT_AT(bhandle, BOBJECT_LINK(bhandle, key));
+
+    for (child = bquery->step[step].child, n = 0; child; 
+	 child = bquery->step[child].next, n++) {
+
+      if (bquery->step[child].type == BQUERY_ANY) {
+	query_step(bhandle, bquery, child, value, run);
+      } else if ((n < QUERY_MATCHBITS) &&
+		 (wanted & (1UL << n)) &&
+		 ((run->symbol)?
+		  (bhandle->symbol[BOBJECT_OFFSET(bhandle, key)] == run->symbol[child]):
+		  ((bquery->step[child].len == len) &&
+		   (memcmp(&bquery->text[bquery->step[child].key], ptr, len) == 0)))) {
+
+	wanted &= ~(1UL << n);
+	query_step(bhandle, bquery, child, value, run);
+      }
+
+      if (run->stop) return;
+    }
+  }
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static void query_list(struct bhandle *bhandle, struct bquery *bquery, int step,
+		       struct bobject *bobject, struct qrun *run) {
+
+  /* Walk the values once up to the last index wanted, a tape list with a
+   * table of it's values has indexes and slices taken from the table
+   */
+  const int table = ((bhandle->tape) && (LIST_INDEXED(bhandle, bobject)));
+  struct bobject *value;
+  poff_t last = 0;
+  poff_t index;
+  int child;
+
+  for (child = bquery->step[step].child; child; child = bquery->step[child].next) {
+
+    const struct bstep *s = &bquery->step[child];
+    poff_t end;
+
+    switch (s->type) {
+    case BQUERY_INDEX:
+      end = s->index + 1;
+      break;
+    case BQUERY_SLICE:
+      end = s->end;
+      break;
+    case BQUERY_ANY:
+      end = QUERY_OPEN;
+      break;
+    default:
+      continue;
+    }
+
+    if (end > LIST_COUNT(bobject)) end = LIST_COUNT(bobject);
+
+    if ((table) && (s->type != BQUERY_ANY)) {
+      for (index = s->index; (index < end) && (!run->stop); index++) {
+	value = BOBJECT_AT(bhandle, LIST_TABLE(bhandle, bobject)[index]);
+	query_step(bhandle, bquery, child, value, run);
+      }
+    } else if (end > last) {
+      last = end;
+    }
+  }
+
+  for (index = 0, value = LIST_FIRST(bhandle, bobject); (value) && (index < last);
+       index++, value = LIST_NEXT(bhandle, value)) {
+
+    for (child = bquery->step[step].child; child; child = bquery->step[child].next) {
+
+      const struct bstep *s = &bquery->step[child];
+
+      if (((s->type == BQUERY_ANY)) ||
+	  ((!table) && (s->type == BQUERY_INDEX) && (s->index == index)) ||
+	  ((!table) && (s->type == BQUERY_SLICE) && (s->index <= index) && (index < s->end))) {
+	query_step(bhandle, bquery, child, value, run);
+      }
+
+      if (run->stop) return;
+    }
+  }
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+int ambencode_query_decode(struct bhandle *bhandle, char *buf, xbsize_t len,
+			   struct bquery *bquery) {
+
+  static const struct bselect select = { query_select };
+
+  return ambencode_decode_select(bhandle, buf, len, &select, bquery);
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static int query_select(void *ctx, int state, char *key, bsize_t len, bsize_t index) {
+
+  /* The state of a container is it's step + 1. A member taken by a 
+   * single step that no path ends at is selected from by that step, a 
+   * member taken by a step a path ends at, or by more than one step, is 
+   * decoded in full.
+   */
+  struct bquery *bquery = (struct bquery *)ctx;
+  int selected = AMBENCODE_SELECT_SKIP;
+  int child;
+
+  if (state == AMBENCODE_SELECT_ALL) return 1;
+
+  for (child = bquery->step[state - 1].child; child; child = bquery->step[child].next) {
+
+    const struct bstep *step = &bquery->step[child];
+
+    switch (step->type) {
+    case BQUERY_KEY:
+      if ((!key) || (step->len != len) ||
+	  (memcmp(&bquery->text[step->key], key, len) != 0)) continue;
+      break;
+    case BQUERY_INDEX:
+      if ((key) || (step->index != index)) continue;
+      break;
+    case BQUERY_SLICE:
+      if ((key) || (step->index > index) || (index >= step->end)) continue;
+      break;
+    }
+
+    if ((step->path) || (!step->child) || 
+	(selected != AMBENCODE_SELECT_SKIP)) return AMBENCODE_SELECT_ALL;
+
+    selected = child + 1;
+  }
+
+  return selected;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+void ambencode_query_free(struct bquery *bquery) {
+
+  free(bquery->step);
+  free(bquery->pathnext);
+  free(bquery->function);
+  free(bquery->text);
+
+  memset(bquery, 0, sizeof(struct bquery));
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
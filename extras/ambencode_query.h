@@ -30,6 +30,56 @@ THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 
 /* -------------------------------------------------------------------- */
 
+#define BQUERY_KEY   0            /* Step to the value of a key */
+#define BQUERY_INDEX 1            /* Step to the value at an index */
+#define BQUERY_SLICE 2            /* Step to the values from index to end */
+#define BQUERY_ANY   3            /* Step to every value */
+
+#define BQUERY_NONE  0            /* Aggregate wrapping a path */
+#define BQUERY_COUNT 1
+#define BQUERY_SUM   2
+#define BQUERY_MIN   3
+#define BQUERY_MAX   4
+
+struct bstep {
+
+  int            type;            /* One of BQUERY_KEY to BQUERY_ANY */
+  size_t         key;             /* Offset of the key in text */
+  bsize_t        len;             /* Length of the key */
+  poff_t         index;           /* Index of the value or slice start */
+  poff_t         end;             /* End of the slice, not included */
+  int            child;           /* First step from this one or 0 */
+  int            next;            /* Next step from the same step or 0 */
+  int            path;            /* First path ending here + 1 or 0 */
+};
+
+struct bquery {
+
+  struct bstep   *step;           /* Steps of every path, paths with a 
+				   * common prefix share it's steps and
+				   * step[0] is the value queried */
+  int            steps;           /* Count of steps */
+  int            *pathnext;       /* Next path ending at the same step + 1
+				   * or 0, for each path */
+  int            paths;           /* Count of paths */
+  int            *function;       /* Aggregate wrapping each path, one of
+				   * BQUERY_NONE to BQUERY_MAX */
+  char           *text;           /* Keys of every step */
+};
+
+struct baggregate {
+
+  unsigned long  count;           /* Count of values matched */
+  unsigned long  integers;        /* Count of them that are integers */
+  int64_t        sum;             /* Sum of the integers */
+  int64_t        min;             /* Least integer */
+  int64_t        max;             /* Greatest integer */
+  int            overflow;        /* An integer or the sum was too large 
+				   * for an int64_t */
+};
+
+/* -------------------------------------------------------------------- */
+
 #ifdef __cplusplus
 extern "C" {  
 #endif
@@ -38,6 +88,100 @@ extern "C" {
 
 struct bobject *ambencode_query(struct bhandle *bhandle, struct bobject *bobject, char *ptr);
 
+/* Summary: Compile a set of query paths, as accepted by ambencode_query(),
+ *          into a program that can be evaluated any number of times by
+ *          ambencode_query_many(). Paths are parsed once and paths with
+ *          a common prefix, such as "info.name" and "info.length", share
+ *          the steps of the prefix. A key of "*" steps to every value of
+ *          a dictionary or list, "[*]" to every value of a list and 
+ *          "[start:end]" to a slice of a list where either may be left 
+ *          out. A path may be wrapped by count(), sum(), min() or max(),
+ *          recorded in bquery->function for ambencode_query_aggregate().
+ * bquery:  This is a pointer to a bquery that will hold the program.
+ * paths:   An array of query paths.
+ * count:   The count of paths.
+ *
+ * Return 0 on success and !0 on failure, in which case errno will be
+ * set to EINVAL if a path is not valid or ENOMEM.
+ */
+int ambencode_query_compile(struct bquery *bquery, char **paths, int count);
+
+/* Summary: Evaluate every path of a program in a single traversal from
+ *          bobject. Each shared step is taken once and the keys wanted
+ *          from a dictionary, or the indexes wanted from a list, are 
+ *          found in one walk of it's values.
+ * bhandle: This is a pointer to a bhandle holding a decoded DOM.
+ * bobject: The value the paths are relative to, usually BOBJECT_ROOT().
+ * bquery:  This is a pointer to a bquery compiled by 
+ *          ambencode_query_compile().
+ * results: An array with an entry for each path, set to the first 
+ *          bobject found or 0 if the path was not found.
+ *
+ * Return the count of paths found.
+ */
+int ambencode_query_many(struct bhandle *bhandle, struct bobject *bobject,
+			 struct bquery *bquery, struct bobject **results);
+
+/* Summary: Evaluate every path of a program in a single traversal from
+ *          bobject, as ambencode_query_many() does, reporting every 
+ *          value matched to a callback. The values matched by each path
+ *          are reported in the order they appear.
+ * bhandle: This is a pointer to a bhandle holding a decoded DOM.
+ * bobject: The value the paths are relative to, usually BOBJECT_ROOT().
+ * bquery:  This is a pointer to a bquery compiled by 
+ *          ambencode_query_compile().
+ * callback:Called with the index of the path and the value matched,
+ *          returning !0 stops the traversal.
+ * ctx:     Passed to callback.
+ *
+ * Return the count of values matched.
+ * A bquery is only read while it is evaluated, one program may be 
+ * evaluated by several threads at once.
+ */
+int ambencode_query_each(struct bhandle *bhandle, struct bobject *bobject,
+			 struct bquery *bquery,
+			 int (*callback)(void *ctx, int path, struct bobject *bobject),
+			 void *ctx);
+
+/* Summary: Aggregate the values matched by every path of a program in a
+ *          single traversal from bobject. Integers are read with 
+ *          ambencode_get_i64() as they are matched, from the table kept
+ *          by ambencode_integers() when there is one, other values are
+ *          counted.
+ * bhandle: This is a pointer to a bhandle holding a decoded DOM.
+ * bobject: The value the paths are relative to, usually BOBJECT_ROOT().
+ * bquery:  This is a pointer to a bquery compiled by 
+ *          ambencode_query_compile().
+ * aggregates: An array with an entry for each path, set to the count,
+ *          sum, min and max of the values it matched.
+ *
+ * Return the count of values matched.
+ */
+int ambencode_query_aggregate(struct bhandle *bhandle, struct bobject *bobject,
+			      struct bquery *bquery, struct baggregate *aggregates);
+
+/* Summary: Decode only the values a program's paths pass through or end
+ *          at, everything else in the buffer is validated but not 
+ *          decoded. The paths then give the same values from the DOM as
+ *          from a full decode, dictionaries only hold the members on a 
+ *          path and list values not on a path are empty strings. 
+ * bhandle: This is a pointer to an initialised bhandle structure.
+ * buf:     This is a pointer to a buffer holding BENCODE data.
+ * len:     This is the length of the BENCODE buffer in bytes.
+ * bquery:  This is a pointer to a bquery compiled by 
+ *          ambencode_query_compile().
+ *
+ * Return 0 on success and !0 on failure, errno is set as by 
+ * ambencode_decode_select().
+ */
+int ambencode_query_decode(struct bhandle *bhandle, char *buf, xbsize_t len,
+			   struct bquery *bquery);
+
+/* Summary: Release a program compiled by ambencode_query_compile().
+ * bquery:  This is a pointer to a bquery.
+ */
+void ambencode_query_free(struct bquery *bquery);
+
 /* -------------------------------------------------------------------- */
 /* -------------------------------------------------------------------- */
 
@@ -24,10 +24,24 @@ THE USE OR OTHER DEALINGS IN THE SOFTWARE.
  * -------------------------------------------------------------------- */
 
 #include <string.h>
+#include <stdlib.h>
+#include <errno.h>
 
 #include "ambencode.h"
 #include "extras/ambencode_util.h"
 
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+
+static struct bfind *find_table(struct bhandle *bhandle, struct bobject *object);
+static struct bfind *find_build(struct bhandle *bhandle, struct bobject *object);
+static struct bfind *find_sort(struct bhandle *bhandle, struct bobject *object);
+static struct bobject *find_hashed(struct bhandle *bhandle, struct bfind *find, char *key, bsize_t len);
+static struct bobject *find_sorted(struct bhandle *bhandle, struct bfind *find, char *key, bsize_t len);
+static int find_compare(struct bhandle *bhandle, struct bobject *bobject, char *key, bsize_t len);
+static int find_eager(struct bhandle *bhandle, struct bobject *bobject);
+static size_t find_hash(const char *ptr, bsize_t len);
+
 /* -------------------------------------------------------------------- */
 /* -------------------------------------------------------------------- */
 struct bobject *ambencode_array_index(struct bhandle *bhandle,
@@ -36,10 +50,16 @@ struct bobject *ambencode_array_index(struct bhandle *bhandle,
 
   if (index >= LIST_COUNT(array)) return (struct bobject *)0;
 
-  next = array->u.object.child;
+  /* A tape list with a table of it's values is indexed directly
+   */
+  if ((bhandle->tape) && (LIST_INDEXED(bhandle, array))) {
+    return BOBJECT_AT(bhandle, LIST_TABLE(bhandle, array)[index]);
+  }
+
+  next = BOBJECT_CHILD(bhandle, array);
   while (index--) {
     struct bobject *bobject = BOBJECT_AT(bhandle, next);
-    next = bobject->next;    
+    next = BOBJECT_LINK(bhandle, bobject);    
   }
 
   return BOBJECT_AT(bhandle, next);
@@ -51,25 +71,318 @@ struct bobject *ambencode_object_find(struct bhandle *bhandle,
 				   struct bobject *object,
 				   char *key,
 				   bsize_t len) {
+  struct bfind *find;
   poff_t next;
 
   if (DICTIONARY_COUNT(object) == 0) return (struct bobject *)0;
 
-  next = object->u.object.child;
+  /* Large dictionaries may be looked up through their key index, a 
+   * sorted index of keys found not to be in order is empty
+   */
+  if ((DICTIONARY_COUNT(object) >= AMBENCODE_FINDMIN * 2) &&
+      ((bhandle->find) || (bhandle->findlazy)) &&
+      ((find = find_table(bhandle, object)))) {
+
+    if (!find->sorted) return find_hashed(bhandle, find, key, len);
+    if (find->mask)    return find_sorted(bhandle, find, key, len);
+  }
+
+  next = BOBJECT_CHILD(bhandle, object);
   do {
 
     struct bobject *bobject = BOBJECT_AT(bhandle, next);
 
     if ((BOBJECT_STRING_LEN(bobject) == len) &&
-	(memcmp(&bhandle->buf[bobject->u.string.offset],
-		key, len) == 0)) {
-      return BOBJECT_AT(bhandle, bobject->next);
+	(memcmp(BOBJECT_STRING_PTR(bhandle, bobject), key, len) == 0)) {
+      return BOBJECT_AT(bhandle, BOBJECT_LINK(bhandle, bobject));
     }
 
-    bobject = BOBJECT_AT(bhandle, bobject->next);
-    next = bobject->next;
+    bobject = BOBJECT_AT(bhandle, BOBJECT_LINK(bhandle, bobject));
+    next = BOBJECT_LINK(bhandle, bobject);
         
   } while (next != AMBENCODE_INVALID);
   
   return (struct bobject *)0;
 }
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+struct bobject *ambencode_object_find_symbol(struct bhandle *bhandle,
+					  struct bobject *object,
+					  bsize_t symbol) {
+  poff_t next;
+
+  if ((DICTIONARY_COUNT(object) == 0) || (symbol == 0)) {
+    return (struct bobject *)0;
+  }
+
+  next = BOBJECT_CHILD(bhandle, object);
+  do {
+
+    struct bobject *bobject = BOBJECT_AT(bhandle, next);
+
+    if (bhandle->symbol[next] == symbol) {
+      return BOBJECT_AT(bhandle, BOBJECT_LINK(bhandle, bobject));
+    }
+
+    bobject = BOBJECT_AT(bhandle, BOBJECT_LINK(bhandle, bobject));
+    next = BOBJECT_LINK(bhandle, bobject);
+        
+  } while (next != AMBENCODE_INVALID);
+  
+  return (struct bobject *)0;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+int ambencode_find_index(struct bhandle *bhandle, int flags) {
+
+  struct bobject *bobject;
+
+  bhandle->findlazy   = (flags & AMBENCODE_FIND_LAZY)?1:0;
+  bhandle->findsorted = (flags & AMBENCODE_FIND_SORTED)?1:0;
+
+  if (flags & AMBENCODE_FIND_EAGER) {
+    for (bobject = BOBJECT_FIRST(bhandle); bobject; bobject = BOBJECT_NEXT(bhandle, bobject)) {
+      if (find_eager(bhandle, bobject) != 0) return -1;
+    }
+  }
+
+  return 0;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static int find_eager(struct bhandle *bhandle, struct bobject *bobject) {
+
+  /* Index every large dictionary below bobject
+   */
+  struct bobject *child;
+
+  if (BOBJECT_TYPE(bobject) >= AMBENCODE_STRING) return 0;
+
+  if ((BOBJECT_TYPE(bobject) == AMBENCODE_DICTIONARY) &&
+      (DICTIONARY_COUNT(bobject) >= AMBENCODE_FINDMIN * 2) &&
+      (!find_table(bhandle, bobject)) &&
+      (!(bhandle->findsorted?find_sort(bhandle, bobject):
+	 find_build(bhandle, bobject)))) return -1;
+
+  for (child = LIST_FIRST(bhandle, bobject); child; child = LIST_NEXT(bhandle, child)) {
+    if (find_eager(bhandle, child) != 0) return -1;
+  }
+
+  return 0;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static struct bfind *find_table(struct bhandle *bhandle, struct bobject *object) {
+
+  /* Return the index of a dictionary, moving it to the front of the 
+   * list so repeated lookups find it first. An index is rebuilt if
+   * the dictionary has been added to since it was built.
+   */
+  const poff_t dictionary = BOBJECT_OFFSET(bhandle, object);
+  struct bfind **pfind;
+  struct bfind *find;
+
+  for (pfind = &bhandle->find; (find = *pfind); pfind = &find->next) {
+
+    if (find->dictionary != dictionary) continue;
+
+    *pfind = find->next;
+    if (find->count == DICTIONARY_COUNT(object)) {
+      find->next    = bhandle->find;
+      bhandle->find = find;
+      return find;
+    }
+
+    free(find);
+    break;
+  }
+
+  if (!bhandle->findlazy)  return (struct bfind *)0;
+  if (bhandle->findsorted) return find_sort(bhandle, object);
+  return find_build(bhandle, object);
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static struct bfind *find_build(struct bhandle *bhandle, struct bobject *object) {
+
+  /* Build an open addressing index of the keys of a dictionary, with at
+   * least twice as many slots as keys. Only the first of any duplicate
+   * keys is indexed, as only it would be found by a linear search.
+   */
+  const bsize_t count = DICTIONARY_COUNT(object);
+  struct bobject *bobject;
+  struct bfind *find;
+  size_t slots = 1;
+  size_t i;
+
+  while (slots < count) slots <<= 1;
+
+  if (slots > (((size_t)-1 - sizeof(struct bfind)) / sizeof(poff_t))) goto fail;
+
+  find = (struct bfind *)calloc(1, sizeof(struct bfind) + 
+				((slots - 1) * sizeof(poff_t)));
+  if (!find) goto fail;
+
+  find->dictionary = BOBJECT_OFFSET(bhandle, object);
+  find->count      = count;
+  find->mask       = slots - 1;
+
+  for (bobject = DICTIONARY_FIRST_KEY(bhandle, object); bobject;
+       bobject = DICTIONARY_NEXT_KEY(bhandle, bobject)) {
+
+    char *ptr = BOBJECT_STRING_PTR(bhandle, bobject);
+    bsize_t len = BOBJECT_STRING_LEN(bobject);
+
+    for (i = find_hash(ptr, len) & find->mask; find->slot[i]; 
+	 i = (i + 1) & find->mask) {
+
+      struct bobject *key = BOBJECT_AT(bhandle, find->slot[i] - 1);
+
+      if ((BOBJECT_STRING_LEN(key) == len) &&
+	  (memcmp(BOBJECT_STRING_PTR(bhandle, key), ptr, len) == 0)) break;
+    }
+
+    if (!find->slot[i]) find->slot[i] = BOBJECT_OFFSET(bhandle, bobject) + 1;
+  }
+
+  find->next    = bhandle->find;
+  bhandle->find = find;
+  return find;
+
+ fail:
+  errno = ENOMEM;
+  return (struct bfind *)0;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static struct bfind *find_sort(struct bhandle *bhandle, struct bobject *object) {
+
+  /* Canonical Bencode has the keys of a dictionary in ascending order,
+   * their offsets can then be binary searched. The order is confirmed
+   * while the offsets are gathered, if the keys are not in order or a 
+   * key is repeated the index is made empty so lookups of the 
+   * dictionary are linear.
+   */
+  const bsize_t keys = DICTIONARY_COUNT(object) / 2;
+  struct bobject *bobject;
+  struct bobject *prev;
+  struct bfind *find;
+  size_t i;
+
+  find = (struct bfind *)malloc(sizeof(struct bfind) + 
+				((keys - 1) * sizeof(poff_t)));
+  if (!find) goto fail;
+
+  find->dictionary = BOBJECT_OFFSET(bhandle, object);
+  find->count      = DICTIONARY_COUNT(object);
+  find->sorted     = 1;
+  find->mask       = keys;
+
+  prev = (struct bobject *)0;
+  for (i = 0, bobject = DICTIONARY_FIRST_KEY(bhandle, object); bobject; 
+       i++, bobject = DICTIONARY_NEXT_KEY(bhandle, bobject)) {
+
+    if ((prev) &&
+	(find_compare(bhandle, prev, BOBJECT_STRING_PTR(bhandle, bobject),
+		      BOBJECT_STRING_LEN(bobject)) >= 0)) {
+
+      struct bfind *empty = (struct bfind *)realloc(find, sizeof(struct bfind));
+
+      if (empty) find = empty;
+      find->mask = 0;
+      break;
+    }
+
+    find->slot[i] = BOBJECT_OFFSET(bhandle, bobject);
+    prev          = bobject;
+  }
+
+  find->next    = bhandle->find;
+  bhandle->find = find;
+  return find;
+
+ fail:
+  errno = ENOMEM;
+  return (struct bfind *)0;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static struct bobject *find_hashed(struct bhandle *bhandle, struct bfind *find, 
+				   char *key, bsize_t len) {
+
+  size_t i = find_hash(key, len) & find->mask;
+
+  for (;; i = (i + 1) & find->mask) {
+
+    struct bobject *bobject;
+
+    if (find->slot[i] == 0) return (struct bobject *)0;
+
+    bobject = BOBJECT_AT(bhandle, find->slot[i] - 1);
+    if ((BOBJECT_STRING_LEN(bobject) == len) &&
+	(memcmp(BOBJECT_STRING_PTR(bhandle, bobject), key, len) == 0)) {
+      return BOBJECT_AT(bhandle, BOBJECT_LINK(bhandle, bobject));
+    }
+  }
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static struct bobject *find_sorted(struct bhandle *bhandle, struct bfind *find, 
+				   char *key, bsize_t len) {
+
+  size_t lo = 0;
+  size_t hi = find->mask;
+
+  while (lo < hi) {
+
+    size_t mid = lo + ((hi - lo) / 2);
+    struct bobject *bobject = BOBJECT_AT(bhandle, find->slot[mid]);
+    int cmp = find_compare(bhandle, bobject, key, len);
+
+    if (cmp == 0) return BOBJECT_AT(bhandle, BOBJECT_LINK(bhandle, bobject));
+
+    if (cmp < 0) lo = mid + 1;
+    else         hi = mid;
+  }
+
+  return (struct bobject *)0;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static int find_compare(struct bhandle *bhandle, struct bobject *bobject, 
+			char *key, bsize_t len) {
+
+  /* Compare a key with a string as raw bytes, a shorter string is 
+   * ordered before any longer string it is a prefix of
+   */
+  const bsize_t blen = BOBJECT_STRING_LEN(bobject);
+  int cmp = memcmp(BOBJECT_STRING_PTR(bhandle, bobject), key, (blen < len)?blen:len);
+
+  if (cmp != 0) return cmp;
+  return (blen < len)?-1:(blen > len);
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static size_t find_hash(const char *ptr, bsize_t len) {
+
+  /* FNV-1a
+   */
+  uint32_t hash = 2166136261U;
+
+  while (len--) {
+    hash ^= (unsigned char)*ptr++;
+    hash *= 16777619U;
+  }
+
+  return (size_t)hash;
+}
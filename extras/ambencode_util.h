@@ -30,6 +30,14 @@ THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 
 /* -------------------------------------------------------------------- */
 
+#define AMBENCODE_FIND_LAZY   1   /* ambencode_find_index() flags */
+#define AMBENCODE_FIND_EAGER  2
+#define AMBENCODE_FIND_SORTED 4
+
+#define AMBENCODE_FINDMIN    32   /* Keys a dictionary needs to be indexed */
+
+/* -------------------------------------------------------------------- */
+
 #ifdef __cplusplus
 extern "C" {  
 #endif
@@ -39,6 +47,44 @@ extern "C" {
 struct bobject *ambencode_array_index(struct bhandle *bhandle, struct bobject *array, poff_t index);
 struct bobject *ambencode_object_find(struct bhandle *bhandle, struct bobject *object, char *key, bsize_t len);
 
+/* Summary: Look up a key of a dictionary by it's symbol, comparing the
+ *          symbol of each key rather than it's bytes.
+ * bhandle: This is a pointer to a bhandle whose keys were interned, see
+ *          ambencode_intern().
+ * object:  The dictionary to search.
+ * symbol:  The symbol of the key, as returned by ambencode_symbol(). 0,
+ *          a key that was never interned, is found in no dictionary.
+ *
+ * Return the value of the key or NULL if it is not found.
+ */
+struct bobject *ambencode_object_find_symbol(struct bhandle *bhandle, struct bobject *object, bsize_t symbol);
+
+/* Summary: Look up the keys of large dictionaries, those with at least
+ *          AMBENCODE_FINDMIN keys, through a hash index held by the 
+ *          bhandle rather than comparing every key. The DOM is not 
+ *          changed, indexes are released by ambencode_reset() and 
+ *          ambencode_free()
+ * bhandle: This is a pointer to a bhandle holding a decoded DOM.
+ * flags:   AMBENCODE_FIND_LAZY indexes a dictionary on it's first lookup
+ *          by ambencode_object_find() and AMBENCODE_FIND_EAGER indexes 
+ *          every large dictionary now. Indexes are hash tables unless
+ *          AMBENCODE_FIND_SORTED is given, the keys are then binary 
+ *          searched in an array of their offsets. This needs half the
+ *          memory or less but only canonical dictionaries, with keys in
+ *          ascending order, are searched this way, others are still 
+ *          compared key by key. Indexes already built are used
+ *          whatever the flags. An index is rebuilt once keys have been
+ *          added to it's dictionary by ambencode_dictionary_add() and
+ *          ambencode_replace() drops every index when it replaces a 
+ *          string or a dictionary, then rebuilt on lookup only with 
+ *          AMBENCODE_FIND_LAZY. Keys changed any other way, such as by
+ *          ambencode_update(), leave indexes stale.
+ *
+ * Return 0 on success and !0 on failure, in which case errno will be
+ * set to ENOMEM.
+ */
+int ambencode_find_index(struct bhandle *bhandle, int flags);
+
 /* -------------------------------------------------------------------- */
 /* -------------------------------------------------------------------- */
 
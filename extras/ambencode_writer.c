@@ -0,0 +1,410 @@
+/* -------------------------------------------------------------------- *
+
+Copyright 2019 Angelo Masci
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the 
+"Software"), to deal in the Software without restriction, including 
+without limitation the rights to use, copy, modify, merge, publish, 
+distribute, sublicense, and/or sell copies of the Software, and to permit 
+persons to whom the Software is furnished to do so, subject to the 
+following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF 
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. 
+IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT
+OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR 
+THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+ * -------------------------------------------------------------------- */
+#include <string.h>
+#include <errno.h>
+
+#include "ambencode.h"
+#include "extras/ambencode_writer.h"
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+
+static int writer_value(struct bwriter *bwriter);
+static void writer_put(struct bwriter *bwriter, const char *ptr, size_t len);
+static void writer_char(struct bwriter *bwriter, char c);
+static void writer_length(struct bwriter *bwriter, bsize_t len);
+static int writer_fail(struct bwriter *bwriter, int error);
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+
+static const char digits[] = 
+  "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+  "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+  "8081828384858687888990919293949596979899";
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+void ambencode_writer_init(struct bwriter *bwriter, char *buf, size_t len,
+			   int flags) {
+
+  /* Levels are initialised as containers are begun
+   */
+  bwriter->buf        = buf;
+  bwriter->len        = len;
+  bwriter->used       = 0;
+  bwriter->iov        = (struct iovec *)0;
+  bwriter->iovcount   = 0;
+  bwriter->iovused    = 0;
+  bwriter->iovmin     = 0;
+  bwriter->start      = 0;
+  bwriter->referenced = 0;
+  bwriter->error      = 0;
+  bwriter->flags      = flags;
+  bwriter->depth      = 0;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+void ambencode_writer_iov(struct bwriter *bwriter, struct iovec *iov, 
+			  int count, size_t min) {
+
+  bwriter->iov      = iov;
+  bwriter->iovcount = count;
+  bwriter->iovmin   = min;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+int ambencode_writer_dict_begin(struct bwriter *bwriter) {
+
+  struct bwlevel *level;
+
+  if ((writer_value(bwriter) != 0) ||
+      ((bwriter->depth == AMBENCODE_MAXDEPTH) && 
+       (writer_fail(bwriter, EINVAL) != 0))) return -1;
+
+  level = &bwriter->level[bwriter->depth++];
+  level->type   = AMBENCODE_DICTIONARY;
+  level->value  = 0;
+  level->key    = 0;
+  level->keylen = 0;
+
+  writer_char(bwriter, 'd');
+  return (bwriter->error)?-1:0;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+int ambencode_writer_list_begin(struct bwriter *bwriter) {
+
+  struct bwlevel *level;
+
+  if ((writer_value(bwriter) != 0) ||
+      ((bwriter->depth == AMBENCODE_MAXDEPTH) && 
+       (writer_fail(bwriter, EINVAL) != 0))) return -1;
+
+  level = &bwriter->level[bwriter->depth++];
+  level->type  = AMBENCODE_LIST;
+  level->value = 0;
+
+  writer_char(bwriter, 'l');
+  return (bwriter->error)?-1:0;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+int ambencode_writer_end(struct bwriter *bwriter) {
+
+  /* A dictionary may not end between a key and it's value
+   */
+  if ((bwriter->error == EINVAL) ||
+      (((bwriter->depth == 0) || 
+	(bwriter->level[bwriter->depth - 1].value)) &&
+       (writer_fail(bwriter, EINVAL) != 0))) return -1;
+
+  bwriter->depth--;
+
+  writer_char(bwriter, 'e');
+  return (bwriter->error)?-1:0;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+int ambencode_writer_key(struct bwriter *bwriter, const char *key, 
+			 bsize_t len) {
+
+  struct bwlevel *level;
+
+  if ((bwriter->error == EINVAL) ||
+      ((bwriter->depth == 0) && (writer_fail(bwriter, EINVAL) != 0))) return -1;
+
+  level = &bwriter->level[bwriter->depth - 1];
+
+  if (((level->type != AMBENCODE_DICTIONARY) || (level->value)) &&
+      (writer_fail(bwriter, EINVAL) != 0)) return -1;
+
+  writer_length(bwriter, len);
+
+  /* Each key must follow the last, keys that have not fit buf are not
+   * compared
+   */
+  if ((bwriter->flags & AMBENCODE_WRITER_CANONICAL) && 
+      (bwriter->used + len <= bwriter->len)) {
+
+    if (level->key) {
+
+      const bsize_t common = (len < level->keylen)?len:level->keylen;
+      const int cmp = memcmp(&bwriter->buf[level->key - 1], key, common);
+
+      if (((cmp > 0) || ((cmp == 0) && (level->keylen >= len))) &&
+	  (writer_fail(bwriter, EINVAL) != 0)) return -1;
+    }
+
+    level->key    = bwriter->used + 1;
+    level->keylen = len;
+  }
+
+  level->value = 1;
+
+  writer_put(bwriter, key, len);
+  return (bwriter->error)?-1:0;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+int ambencode_writer_str(struct bwriter *bwriter, const char *ptr, 
+			 bsize_t len) {
+
+  if (writer_value(bwriter) != 0) return -1;
+
+  writer_length(bwriter, len);
+
+  /* A long string is referenced by an entry of it's own after one for
+   * the bytes before it, an entry is always left for the bytes after 
+   * the last string
+   */
+  if ((bwriter->iov) && (len >= bwriter->iovmin) && 
+      (bwriter->iovused + 3 <= bwriter->iovcount) &&
+      (bwriter->used <= bwriter->len)) {
+
+    struct iovec *iov = &bwriter->iov[bwriter->iovused];
+
+    iov[0].iov_base = &bwriter->buf[bwriter->start];
+    iov[0].iov_len  = bwriter->used - bwriter->start;
+    iov[1].iov_base = (char *)ptr;
+    iov[1].iov_len  = len;
+
+    bwriter->iovused    += 2;
+    bwriter->start       = bwriter->used;
+    bwriter->referenced += len;
+
+  } else {
+    writer_put(bwriter, ptr, len);
+  }
+
+  return (bwriter->error)?-1:0;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+int ambencode_writer_int(struct bwriter *bwriter, int64_t value) {
+
+  /* The digits are formed from the end two at a time. An integer is 
+   * decoded from at most 19 characters including any sign, one below
+   * -999999999999999999 could not be read back.
+   */
+  char buf[24];
+  char *ptr = &buf[sizeof(buf) - 1];
+  uint64_t magnitude;
+
+  if (value < -INT64_C(999999999999999999)) return writer_fail(bwriter, EINVAL);
+  if (writer_value(bwriter) != 0) return -1;
+
+  magnitude = (value < 0)?(uint64_t)-value:(uint64_t)value;
+
+  *ptr = 'e';
+
+  while (magnitude >= 100) {
+    const size_t pair = (size_t)(magnitude % 100) * 2;
+
+    magnitude /= 100;
+    *--ptr = digits[pair + 1];
+    *--ptr = digits[pair];
+  }
+
+  if (magnitude >= 10) {
+    *--ptr = digits[magnitude * 2 + 1];
+    *--ptr = digits[magnitude * 2];
+  } else {
+    *--ptr = (char)('0' + magnitude);
+  }
+
+  if (value < 0) *--ptr = '-';
+  *--ptr = 'i';
+
+  writer_put(bwriter, ptr, &buf[sizeof(buf)] - ptr);
+  return (bwriter->error)?-1:0;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+char *ambencode_writer_reserve(struct bwriter *bwriter, bsize_t len) {
+
+  char *ptr;
+
+  if (writer_value(bwriter) != 0) return (char *)0;
+
+  writer_length(bwriter, len);
+
+  ptr = &bwriter->buf[bwriter->used];
+  if (bwriter->used + len <= bwriter->len) memset(ptr, 0, len);
+  bwriter->used += len;
+
+  if ((bwriter->used > bwriter->len) && 
+      (writer_fail(bwriter, ENOSPC) != 0)) return (char *)0;
+
+  return (bwriter->error)?(char *)0:ptr;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+int ambencode_writer_finish(struct bwriter *bwriter, size_t *len) {
+
+  if ((bwriter->depth) && (writer_fail(bwriter, EINVAL) != 0)) return -1;
+
+  *len = bwriter->used + bwriter->referenced;
+
+  /* The bytes after the last string referenced, there are none to refer
+   * to when buf is too small
+   */
+  if ((bwriter->iov) && (bwriter->iovcount) && (!bwriter->error) &&
+      (bwriter->used > bwriter->start)) {
+
+    struct iovec *iov = &bwriter->iov[bwriter->iovused++];
+
+    iov->iov_base = &bwriter->buf[bwriter->start];
+    iov->iov_len  = bwriter->used - bwriter->start;
+    bwriter->start = bwriter->used;
+  }
+
+  if (bwriter->error) {
+    errno = bwriter->error;
+    return -1;
+  }
+
+  return 0;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static int writer_value(struct bwriter *bwriter) {
+
+  /* A value may begin a document, be a member of a list or follow a 
+   * key
+   */
+  struct bwlevel *level;
+
+  if (bwriter->error == EINVAL) return -1;
+  if (bwriter->depth == 0) return 0;
+
+  level = &bwriter->level[bwriter->depth - 1];
+
+  if (level->type == AMBENCODE_DICTIONARY) {
+    if (!level->value) return writer_fail(bwriter, EINVAL);
+    level->value = 0;
+  }
+
+  return 0;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static void writer_put(struct bwriter *bwriter, const char *ptr, size_t len) {
+
+  /* Bytes that do not fit are counted so the size needed is known
+   */
+  if (bwriter->used + len <= bwriter->len) {
+    memcpy(&bwriter->buf[bwriter->used], ptr, len);
+  } else if (!bwriter->error) {
+    bwriter->error = ENOSPC;
+  }
+
+  bwriter->used += len;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static void writer_char(struct bwriter *bwriter, char c) {
+
+  if (bwriter->used < bwriter->len) {
+    bwriter->buf[bwriter->used] = c;
+  } else if (!bwriter->error) {
+    bwriter->error = ENOSPC;
+  }
+
+  bwriter->used++;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static void writer_length(struct bwriter *bwriter, bsize_t len) {
+
+  /* Put a string's length prefix and it's ':', the short lengths of 
+   * most keys are put directly
+   */
+  char buf[16];
+  char *ptr = &buf[sizeof(buf) - 1];
+
+  if ((len < 100) && (bwriter->used + 3 <= bwriter->len)) {
+
+    char *dst = &bwriter->buf[bwriter->used];
+
+    if (len < 10) {
+      dst[0] = (char)('0' + len);
+      dst[1] = ':';
+      bwriter->used += 2;
+    } else {
+      dst[0] = digits[len * 2];
+      dst[1] = digits[len * 2 + 1];
+      dst[2] = ':';
+      bwriter->used += 3;
+    }
+    return;
+  }
+
+  *ptr = ':';
+
+  while (len >= 100) {
+    const size_t pair = (len % 100) * 2;
+
+    len /= 100;
+    *--ptr = digits[pair + 1];
+    *--ptr = digits[pair];
+  }
+
+  if (len >= 10) {
+    *--ptr = digits[len * 2 + 1];
+    *--ptr = digits[len * 2];
+  } else {
+    *--ptr = (char)('0' + len);
+  }
+
+  writer_put(bwriter, ptr, &buf[sizeof(buf)] - ptr);
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static int writer_fail(struct bwriter *bwriter, int error) {
+
+  /* Keep the first failure, a value out of place also replaces a buffer
+   * that is too small as no further output is meaningful
+   */
+  if ((!bwriter->error) || (error == EINVAL)) bwriter->error = error;
+  return -1;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
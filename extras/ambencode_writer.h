@@ -0,0 +1,161 @@
+/* -------------------------------------------------------------------- *
+
+Copyright 2019 Angelo Masci
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the 
+"Software"), to deal in the Software without restriction, including 
+without limitation the rights to use, copy, modify, merge, publish, 
+distribute, sublicense, and/or sell copies of the Software, and to permit 
+persons to whom the Software is furnished to do so, subject to the 
+following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF 
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. 
+IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT
+OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR 
+THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+ * -------------------------------------------------------------------- */
+
+#ifndef _AMBENCODE_WRITER_H_
+#define _AMBENCODE_WRITER_H_
+
+#include <sys/uio.h>
+
+#include "ambencode.h"
+
+/* -------------------------------------------------------------------- */
+
+#define AMBENCODE_WRITER_CANONICAL 0x01 /* Check keys are in ascending order */
+
+struct bwlevel {
+
+  int            type;            /* AMBENCODE_DICTIONARY or AMBENCODE_LIST */
+  int            value;           /* A key is waiting for it's value */
+  size_t         key;             /* Offset of the last key + 1 or 0 */
+  bsize_t        keylen;          /* Length of the last key */
+};
+
+struct bwriter {
+
+  char           *buf;            /* Encoded bytes */
+  size_t         len;             /* Size of buf */
+  size_t         used;            /* Bytes encoded into buf, more than len
+				   * once buf is too small */
+  struct iovec   *iov;            /* Scatter list of the output or NULL */
+  int            iovcount;        /* Size of iov */
+  int            iovused;         /* Entries of iov used */
+  size_t         iovmin;          /* Strings this long are referenced */
+  size_t         start;           /* Offset of the bytes of buf not yet in
+				   * iov */
+  size_t         referenced;      /* Bytes referenced by iov */
+  int            error;           /* errno of the first failure or 0 */
+  int            flags;           /* AMBENCODE_WRITER_* */
+  int            depth;           /* Containers open */
+  struct bwlevel level[AMBENCODE_MAXDEPTH];
+};
+
+/* -------------------------------------------------------------------- */
+
+#ifdef __cplusplus
+extern "C" {  
+#endif
+
+/* -------------------------------------------------------------------- */
+
+/* Summary: Initialise a writer that encodes BENCODE directly into buf, 
+ *          without building a DOM. Values are written in the order they
+ *          are encoded, containers are begun and ended and the members 
+ *          of a dictionary are a key followed by it's value. Several 
+ *          documents may be written one after another.
+ * bwriter: This is a pointer to an uninitialised bwriter structure.
+ * buf:     This is a pointer to the buffer encoded into.
+ * len:     This is the size of buf in bytes.
+ * flags:   AMBENCODE_WRITER_CANONICAL checks that the keys of every
+ *          dictionary are in ascending order, as canonical BENCODE
+ *          requires, at the cost of comparing each key with the last.
+ */
+void ambencode_writer_init(struct bwriter *bwriter, char *buf, size_t len,
+			   int flags);
+
+/* Summary: Output to a scatter list, for writev() or sendmsg(), rather 
+ *          than only to buf. Strings of at least min bytes are not 
+ *          copied, an entry of iov refers to them and they must remain
+ *          unchanged until the output has been sent. The other bytes are
+ *          encoded into buf and referred to by entries between them.
+ *          Keys are always copied and strings are copied once too few
+ *          entries remain.
+ * bwriter: This is a pointer to an initialised bwriter structure.
+ * iov:     This is a pointer to count iovec entries, at least one.
+ * count:   This is the number of entries of iov.
+ * min:     The length from which strings are referenced.
+ */
+void ambencode_writer_iov(struct bwriter *bwriter, struct iovec *iov, 
+			  int count, size_t min);
+
+/* Summary: Write a value, begin or end a container or write a key. 
+ *          Failures are kept by the writer, a call that follows one
+ *          also fails and the failure is reported by 
+ *          ambencode_writer_finish(), so the result of each need not be
+ *          checked. Bytes that do not fit buf are still counted, a value
+ *          out of place stops the writer.
+ * bwriter: This is a pointer to an initialised bwriter structure.
+ *
+ * Return 0 on success and !0 on failure.
+ * The value of errno will be set to ENOSPC if buf is too small and 
+ * EINVAL if the value is out of place, such as a key outside of a 
+ * dictionary, a value without a key, an end without a begin, a key out 
+ * of order or containers nested more than AMBENCODE_MAXDEPTH deep, or
+ * is an integer below -999999999999999999, longer than the 19 
+ * characters ambencode_decode() accepts.
+ */
+int ambencode_writer_dict_begin(struct bwriter *bwriter);
+int ambencode_writer_list_begin(struct bwriter *bwriter);
+int ambencode_writer_end(struct bwriter *bwriter);
+int ambencode_writer_key(struct bwriter *bwriter, const char *key, 
+			 bsize_t len);
+int ambencode_writer_str(struct bwriter *bwriter, const char *ptr, 
+			 bsize_t len);
+int ambencode_writer_int(struct bwriter *bwriter, int64_t value);
+
+/* Summary: Write a string value of len bytes whose bytes are to be filled
+ *          in by the caller, now or later. A template such as a reply
+ *          that differs only in it's transaction id can be encoded once,
+ *          copied for each use and only the reserved bytes patched.
+ * bwriter: This is a pointer to an initialised bwriter structure.
+ * len:     This is the length of the string.
+ *
+ * Return a pointer to the len bytes of the string in buf, which are 
+ * zeroed, or NULL on failure, errno being set as by the calls above. 
+ * The offset of the string in the encoded output is the pointer less buf
+ * when no scatter list is used.
+ */
+char *ambencode_writer_reserve(struct bwriter *bwriter, bsize_t len);
+
+/* Summary: Complete the output of a writer.
+ * bwriter: This is a pointer to an initialised bwriter structure.
+ * len:     On success this is set to the length of the encoded output,
+ *          when buf was too small it is set to the size needed.
+ *
+ * Return 0 on success and !0 on failure.
+ * The value of errno will be set to EINVAL if any value was out of 
+ * place or a container has not been ended and otherwise to ENOSPC if buf
+ * was too small. With a scatter list 
+ * bwriter->iovused entries of iov describe the output.
+ */
+int ambencode_writer_finish(struct bwriter *bwriter, size_t *len);
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif